@@ -0,0 +1,544 @@
+/*
+ * Headless head tracker daemon
+ * Talks to the head tracker through a raw Linux MIDI device, and publishes
+ * its orientation to the orientation bus and/or over OSC.
+ * This program doesn't need JUCE!
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HeadMatrix.h"
+#include "Tracker.h"
+#include "OrientationBus.h"
+#include "osc-OscFormat.h"
+
+namespace
+{
+    constexpr int RetryMilliseconds = 500;      // between looks for the head tracker
+    constexpr int FirstFrameMilliseconds = 1000; // before turning it on again
+    constexpr int PollMilliseconds = 100;
+    constexpr float DegreesPerRadian = 57.2957795f;
+
+    volatile std::sig_atomic_t quitRequested = 0;
+    volatile std::sig_atomic_t zeroRequested = 0;
+
+    void handleSignal(int signalNumber)
+    {
+        if (signalNumber == SIGUSR1)
+        {
+            zeroRequested = 1;
+        }
+        else
+        {
+            quitRequested = 1;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    double nowMilliseconds()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ------------------------------------------------------------------------
+
+    struct Options
+    {
+        std::string device;                     // empty: find it
+        std::string busName = OrientationBus::DefaultName;
+        bool useBus = true;
+        std::vector<std::string> oscTargets;    // host:port
+        bool oscQuaternion = true;
+        bool oscYPR = false;
+        bool use100Hz = false;
+        bool verbose = false;
+    };
+
+    // ------------------------------------------------------------------------
+
+    void printUsage(const char* name)
+    {
+        std::fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --device PATH      raw MIDI device, such as /dev/snd/midiC1D0 (default: find the head tracker)\n"
+            "  --bus NAME         orientation bus name (default: %s)\n"
+            "  --no-bus           don't publish to the orientation bus\n"
+            "  --osc HOST:PORT    also send OSC here; may be repeated\n"
+            "  --osc-content C    quaternion, ypr or both (default: quaternion)\n"
+            "  --100hz            ask for 100 frames per second, rather than 50\n"
+            "  --verbose          report frame counts once a second\n"
+            "Send SIGUSR1 to zero the head tracker; SIGINT or SIGTERM to stop.\n",
+            name, OrientationBus::DefaultName);
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = (i + 1 < argc);
+            if ((arg == "--device") && hasValue)     options.device = argv[++i];
+            else if ((arg == "--bus") && hasValue)   options.busName = argv[++i];
+            else if (arg == "--no-bus")              options.useBus = false;
+            else if ((arg == "--osc") && hasValue)   options.oscTargets.push_back(argv[++i]);
+            else if ((arg == "--osc-content") && hasValue)
+            {
+                const std::string content = argv[++i];
+                options.oscQuaternion = (content == "quaternion") || (content == "both");
+                options.oscYPR = (content == "ypr") || (content == "both");
+                if (!options.oscQuaternion && !options.oscYPR) return false;
+            }
+            else if (arg == "--100hz")               options.use100Hz = true;
+            else if (arg == "--verbose")             options.verbose = true;
+            else return false;
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Looks through /proc/asound/cards for the head tracker, and returns the
+        path of its first raw MIDI device, or an empty string. Each card has
+        a line of the form " 1 [Tracker        ]: USB-Audio - Head Tracker". */
+    std::string findDevice()
+    {
+        std::ifstream cards("/proc/asound/cards");
+        std::string line;
+        while (std::getline(cards, line))
+        {
+            int card;
+            if ((std::sscanf(line.c_str(), " %d [", &card) == 1) && (line.find("Head Tracker") != std::string::npos))
+            {
+                const std::string path = "/dev/snd/midiC" + std::to_string(card) + "D0";
+                if (access(path.c_str(), R_OK | W_OK) == 0)
+                {
+                    return path;
+                }
+            }
+        }
+        return std::string();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Collects System Exclusive messages from a raw MIDI byte stream and
+        passes them to the Tracker, without their 0xF0 and 0xF7. */
+    class SysExParser
+    {
+    public:
+        SysExParser() : length(0), inSysEx(false) {}
+
+        void reset()
+        {
+            length = 0;
+            inSysEx = false;
+        }
+
+        void parse(const uint8_t* data, const size_t numBytes, Tracker& tracker)
+        {
+            for (size_t i = 0; i < numBytes; ++i)
+            {
+                const uint8_t b = data[i];
+                if (b >= 0xf8)
+                {
+                    continue; // realtime bytes may appear anywhere
+                }
+                if (b == 0xf0)
+                {
+                    inSysEx = true;
+                    length = 0;
+                }
+                else if (b == 0xf7)
+                {
+                    if (inSysEx && (length >= 5))
+                    {
+                        tracker.processSysex(buffer, length);
+                    }
+                    inSysEx = false;
+                }
+                else if (b & 0x80)
+                {
+                    inSysEx = false; // any other status byte ends it
+                }
+                else if (inSysEx)
+                {
+                    if (length < sizeof(buffer))
+                    {
+                        buffer[length++] = b;
+                    }
+                    else
+                    {
+                        inSysEx = false; // too long to be ours
+                    }
+                }
+            }
+        }
+
+    private:
+        uint8_t buffer[64];
+        size_t length;
+        bool inSysEx;
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Sends each frame to the OSC targets from a preallocated packet. */
+    class OscOutput
+    {
+    public:
+        OscOutput() : socketFd(-1), encoder(packet, sizeof(packet)) {}
+
+        ~OscOutput()
+        {
+            if (socketFd >= 0)
+            {
+                close(socketFd);
+            }
+        }
+
+        /** Resolves host:port once, at startup. */
+        bool addTarget(const std::string& target)
+        {
+            const size_t colon = target.rfind(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+            const std::string host = target.substr(0, colon);
+            const std::string port = target.substr(colon + 1);
+            addrinfo hints {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* result = nullptr;
+            if ((getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) || !result)
+            {
+                return false;
+            }
+            sockaddr_storage address {};
+            std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+            addresses.push_back({ address, result->ai_addrlen });
+            freeaddrinfo(result);
+
+            if (socketFd < 0)
+            {
+                socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            }
+            return socketFd >= 0;
+        }
+
+        bool isActive() const { return !addresses.empty(); }
+
+        void send(const float* quaternion, const float* yprDegrees, const bool sendQuaternion, const bool sendYPR)
+        {
+            if (sendQuaternion)
+            {
+                encoder.addMessage("/quaternion", quaternion, 4);
+                sendPacket();
+            }
+            if (sendYPR)
+            {
+                encoder.addMessage("/ypr", yprDegrees, 3);
+                sendPacket();
+            }
+        }
+
+    private:
+        struct Address
+        {
+            sockaddr_storage address;
+            socklen_t length;
+        };
+
+        int socketFd;
+        std::vector<Address> addresses;
+        uint8_t packet[256];
+        Osc::Encoder encoder;
+
+        void sendPacket()
+        {
+            for (const Address& a: addresses)
+            {
+                sendto(socketFd, encoder.getData(), encoder.getSize(), MSG_DONTWAIT,
+                       reinterpret_cast<const sockaddr*>(&a.address), a.length);
+            }
+            encoder.reset();
+        }
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Receives frames from the Tracker and publishes them. */
+    class Publisher : public Tracker::Listener
+    {
+    public:
+        Publisher(const Options& daemonOptions, OrientationBus::Writer& busWriter, OscOutput& oscOutput) :
+            options(daemonOptions),
+            bus(busWriter),
+            osc(oscOutput),
+            frames(0)
+        {}
+
+        void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+        {
+            head.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+            publish();
+        }
+        void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+        {
+            head.setOrientationQuaternion(qw, qx, qy, qz);
+            publish();
+        }
+        void trackerOrientationM(float* matrix) override
+        {
+            head.setOrientationMatrix(matrix);
+            publish();
+        }
+
+        uint64_t getFrameCount() const { return frames; }
+
+    private:
+        const Options& options;
+        OrientationBus::Writer& bus;
+        OscOutput& osc;
+        HeadMatrix head;
+        uint64_t frames;
+
+        void publish()
+        {
+            ++frames;
+            float q[4], m[9], ypr[3];
+            head.getQuaternion(q[0], q[1], q[2], q[3]);
+            if (bus.isOpen())
+            {
+                head.getMatrix(m);
+                bus.publish(q, m);
+            }
+            if (osc.isActive())
+            {
+                head.getYPR(ypr[0], ypr[1], ypr[2]);
+                for (float& angle: ypr)
+                {
+                    angle *= DegreesPerRadian;
+                }
+                osc.send(q, ypr, options.oscQuaternion, options.oscYPR);
+            }
+        }
+    };
+
+    // ------------------------------------------------------------------------
+
+    bool writeMessage(const int fd, const uint8_t* message, const size_t numBytes)
+    {
+        size_t written = 0;
+        while (written < numBytes)
+        {
+            const ssize_t n = write(fd, message + written, numBytes - written);
+            if (n > 0)
+            {
+                written += static_cast<size_t>(n);
+            }
+            else if ((n < 0) && (errno == EAGAIN))
+            {
+                pollfd p { fd, POLLOUT, 0 };
+                poll(&p, 1, PollMilliseconds);
+            }
+            else if (!((n < 0) && (errno == EINTR)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool turnOn(const int fd, const Tracker& tracker, const bool use100Hz)
+    {
+        uint8_t message[16];
+        size_t numBytes = tracker.turnOnMessage(message, Tracker::AngleMode::Quaternion, use100Hz);
+        if (!writeMessage(fd, message, numBytes))
+        {
+            return false;
+        }
+        numBytes = tracker.readbackMessage(message);
+        return writeMessage(fd, message, numBytes);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Runs one connection to the head tracker, until it goes away or we're
+        asked to quit. */
+    void runDevice(const int fd, Tracker& tracker, const Publisher& publisher, const Options& options)
+    {
+        SysExParser parser;
+        uint8_t buffer[256];
+        uint64_t framesSeen = publisher.getFrameCount();
+        double lastFrameTime = nowMilliseconds();
+        double lastReportTime = lastFrameTime;
+        uint64_t lastReportFrames = framesSeen;
+        bool streaming = false;
+
+        if (!turnOn(fd, tracker, options.use100Hz))
+        {
+            return;
+        }
+
+        while (!quitRequested)
+        {
+            pollfd p { fd, POLLIN, 0 };
+            const int ready = poll(&p, 1, PollMilliseconds);
+            if ((ready < 0) && (errno != EINTR))
+            {
+                return;
+            }
+            if (p.revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                return; // unplugged
+            }
+            if (p.revents & POLLIN)
+            {
+                const ssize_t n = read(fd, buffer, sizeof(buffer));
+                if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+                {
+                    return;
+                }
+                if (n > 0)
+                {
+                    parser.parse(buffer, static_cast<size_t>(n), tracker);
+                }
+            }
+
+            const double now = nowMilliseconds();
+            const uint64_t frames = publisher.getFrameCount();
+            if (frames != framesSeen)
+            {
+                framesSeen = frames;
+                lastFrameTime = now;
+                if (!streaming)
+                {
+                    std::fprintf(stderr, "streaming\n");
+                    streaming = true;
+                }
+            }
+            else if (now - lastFrameTime > FirstFrameMilliseconds)
+            {
+                // the turn-on message went astray, or the tracker was reset
+                if (streaming)
+                {
+                    std::fprintf(stderr, "stream stopped: turning on again\n");
+                    streaming = false;
+                }
+                if (!turnOn(fd, tracker, options.use100Hz))
+                {
+                    return;
+                }
+                lastFrameTime = now;
+            }
+
+            if (zeroRequested)
+            {
+                zeroRequested = 0;
+                uint8_t message[16];
+                writeMessage(fd, message, tracker.zeroMessage(message));
+            }
+
+            if (options.verbose && (now - lastReportTime >= 1000.0))
+            {
+                std::fprintf(stderr, "%llu frames/s\n", static_cast<unsigned long long>(frames - lastReportFrames));
+                lastReportTime = now;
+                lastReportFrames = frames;
+            }
+        }
+
+        uint8_t message[16];
+        writeMessage(fd, message, tracker.turnOffMessage(message));
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    struct sigaction action {};
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGUSR1, &action, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    OrientationBus::Writer bus;
+    if (options.useBus && !bus.open(options.busName.c_str()))
+    {
+        std::fprintf(stderr, "can't open the orientation bus %s: %s\n", options.busName.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    OscOutput osc;
+    for (const std::string& target: options.oscTargets)
+    {
+        if (!osc.addTarget(target))
+        {
+            std::fprintf(stderr, "can't send OSC to %s\n", target.c_str());
+            return 1;
+        }
+    }
+
+    Publisher publisher(options, bus, osc);
+    Tracker tracker(&publisher);
+    bool waiting = false;
+
+    while (!quitRequested)
+    {
+        const std::string path = options.device.empty() ? findDevice() : options.device;
+        const int fd = path.empty() ? -1 : open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+        {
+            if (!waiting)
+            {
+                std::fprintf(stderr, "waiting for the head tracker\n");
+                waiting = true;
+            }
+            poll(nullptr, 0, RetryMilliseconds);
+            continue;
+        }
+
+        std::fprintf(stderr, "connected to %s\n", path.c_str());
+        waiting = false;
+        runDevice(fd, tracker, publisher, options);
+        close(fd);
+        if (!quitRequested)
+        {
+            std::fprintf(stderr, "disconnected\n");
+        }
+    }
+    return 0;
+}
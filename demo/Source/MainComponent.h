@@ -4,7 +4,9 @@
 
 #include "HeadMatrix.h"
 #include "Tracker.h"
+#include "OrientationBus.h"
 #include "midi.h"
+#include "osc.h"
 #include "configPanel.h"
 #include "headPanel.h"
 
@@ -9,7 +9,7 @@
 class HeadMatrix
 {
 public:
-    HeadMatrix() : matrixChanged(false)
+    HeadMatrix() : frameCount(0), matrixChanged(false)
     {
         eyeMatrix(matrix);
         eyeMatrix(&matrix[9]);
@@ -38,6 +38,17 @@ public:
         return false;
     }
 
+    // --------------------------------------------------------------------
+
+    /** Counts every new orientation (and zero()): compare it with a count
+        saved earlier to see whether anything derived from the matrix needs
+        working out again. Unlike hasMatrixChanged(), any number of
+        consumers can do this independently. */
+    uint32_t getFrameCount() const
+    {
+        return frameCount;
+    }
+
     // --------------------------------------------------------------------
         
     void setOrientationYPR(float yawRadian, float pitchRadian, float rollRadian)
@@ -78,6 +89,75 @@ public:
 
     // --------------------------------------------------------------------
 
+    /** Copies the current rotation matrix (row-major, nine floats) into destination. */
+    void getMatrix(float* destination) const
+    {
+        for (uint8_t i = 0; i < 9; ++i)
+        {
+            destination[i] = matRead[i];
+        }
+    }
+
+    // --------------------------------------------------------------------
+
+    /** The current rotation as a unit quaternion, with w >= 0. */
+    void getQuaternion(float& w, float& x, float& y, float& z) const
+    {
+        const float* m = matRead;
+        const float trace = m[0] + m[4] + m[8];
+        // take the square root of whichever term is largest, for accuracy
+        if (trace > 0.0f)
+        {
+            const float s = 2.0f * sqrtf(trace + 1.0f); // 4w
+            w = 0.25f * s;
+            x = (m[7] - m[5]) / s;
+            y = (m[2] - m[6]) / s;
+            z = (m[3] - m[1]) / s;
+        }
+        else if ((m[0] > m[4]) && (m[0] > m[8]))
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[0] - m[4] - m[8]); // 4x
+            w = (m[7] - m[5]) / s;
+            x = 0.25f * s;
+            y = (m[1] + m[3]) / s;
+            z = (m[2] + m[6]) / s;
+        }
+        else if (m[4] > m[8])
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[4] - m[0] - m[8]); // 4y
+            w = (m[2] - m[6]) / s;
+            x = (m[1] + m[3]) / s;
+            y = 0.25f * s;
+            z = (m[5] + m[7]) / s;
+        }
+        else
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[8] - m[0] - m[4]); // 4z
+            w = (m[3] - m[1]) / s;
+            x = (m[2] + m[6]) / s;
+            y = (m[5] + m[7]) / s;
+            z = 0.25f * s;
+        }
+        if (w < 0.0f)
+        {
+            w = -w; x = -x; y = -y; z = -z;
+        }
+    }
+
+    // --------------------------------------------------------------------
+
+    /** The current rotation as yaw, pitch and roll: the inverse of
+        setOrientationYPR(). Pitch is within +/- pi/2. */
+    void getYPR(float& yawRadian, float& pitchRadian, float& rollRadian) const
+    {
+        const float* m = matRead;
+        pitchRadian = asinf(std::max(-1.0f, std::min(1.0f, m[7])));
+        yawRadian = atan2f(-m[1], m[4]);
+        rollRadian = atan2f(-m[6], m[8]);
+    }
+
+    // --------------------------------------------------------------------
+
     /** Transform body coordinates to world-based coordinates: most
         usefully, to paint the animated head. */
     void transform(float& x, float& y, float &z) const
@@ -133,6 +213,7 @@ private:
     float* matWrite;
     float* matRead;
     uint8_t matWriteIndex;
+    uint32_t frameCount;
     bool matrixChanged;
 
     // ------------------------------------------------------------------------
@@ -154,6 +235,7 @@ private:
         matRead = &matrix[matWriteIndex];
         matWriteIndex = 9 - matWriteIndex;
         matWrite = &matrix[matWriteIndex];
+        ++frameCount;
         matrixChanged = true;
     }
 
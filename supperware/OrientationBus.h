@@ -0,0 +1,262 @@
+/*
+ * Orientation bus: head orientation shared between processes
+ * through a memory-mapped ring buffer.
+ * This class doesn't need JUCE!
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+ #define ORIENTATIONBUS_AVAILABLE 1
+#else
+ #define ORIENTATIONBUS_AVAILABLE 0
+#endif
+
+/** One process (the one that owns the head tracker) publishes each frame of
+    orientation into a small ring of slots in shared memory; any number of
+    other processes read the latest frame without locks, system calls or
+    MIDI. Each slot is protected by a sequence count, so a reader never sees
+    a half-written frame, and the writer never waits for readers.
+
+    Available where POSIX shared memory is (Linux and macOS); elsewhere,
+    open() returns false. */
+namespace OrientationBus
+{
+    static constexpr const char* DefaultName = "/supperware-orientation";
+
+    /** One frame. The timestamp comes from std::chrono::steady_clock, which on
+        Linux and macOS is shared by every process on the machine. */
+    struct Frame
+    {
+        uint64_t frameNumber;
+        uint64_t timestampNanoseconds;
+        float quaternion[4]; // w, x, y, z
+        float matrix[9];     // row-major, as HeadMatrix
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** The layout of the shared memory. Everything in it is an atomic word, so
+        that processes may read it while it is being written. */
+    struct Layout
+    {
+        static constexpr uint32_t Magic = 0x48544f42; // 'HTOB'
+        static constexpr uint32_t Version = 1;
+        static constexpr uint32_t NumSlots = 16;
+        static constexpr uint32_t FrameWords = sizeof(Frame) / sizeof(uint32_t);
+
+        struct Slot
+        {
+            std::atomic<uint32_t> sequence; // odd while being written
+            std::atomic<uint32_t> words[FrameWords];
+        };
+
+        std::atomic<uint32_t> magic;
+        std::atomic<uint32_t> version;
+        std::atomic<uint64_t> framesWritten;
+        Slot slots[NumSlots];
+    };
+
+    static_assert(sizeof(Frame) % sizeof(uint32_t) == 0, "Frame must be a whole number of words");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                  "shared-memory atomics must be lock-free");
+
+    // ------------------------------------------------------------------------
+
+    /** Maps the named shared memory; the base of Writer and Reader. The writer
+        maps it read-write, creating it if need be; readers map it read-only,
+        so they need only read permission, and only ever load from layout. */
+    class Mapping
+    {
+    public:
+        Mapping() : layout(nullptr) {}
+        ~Mapping() { close(); }
+
+        bool isOpen() const { return layout != nullptr; }
+
+        void close()
+        {
+           #if ORIENTATIONBUS_AVAILABLE
+            if (layout)
+            {
+                munmap(layout, sizeof(Layout));
+                layout = nullptr;
+            }
+           #endif
+        }
+
+    protected:
+        Layout* layout;
+
+        bool map(const char* name, const bool create)
+        {
+            close();
+           #if ORIENTATIONBUS_AVAILABLE
+            const int fd = shm_open(name, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if ((fstat(fd, &st) != 0) ||
+                ((static_cast<size_t>(st.st_size) < sizeof(Layout)) && (!create || (ftruncate(fd, sizeof(Layout)) != 0))))
+            {
+                ::close(fd);
+                return false;
+            }
+            void* address = mmap(nullptr, sizeof(Layout), create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (address == MAP_FAILED)
+            {
+                return false;
+            }
+            layout = static_cast<Layout*>(address);
+            return true;
+           #else
+            (void)name;
+            (void)create;
+            return false;
+           #endif
+        }
+
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Publishes frames. There should be only one writer per bus; it may be
+        stopped and restarted without disturbing readers. */
+    class Writer : public Mapping
+    {
+    public:
+        bool open(const char* name = DefaultName)
+        {
+            if (!map(name, true))
+            {
+                return false;
+            }
+            if ((layout->magic.load() != Layout::Magic) || (layout->version.load() != Layout::Version))
+            {
+                // new (or incompatible) memory: a fresh mapping is all zeros
+                layout->framesWritten.store(0);
+                for (Layout::Slot& slot: layout->slots)
+                {
+                    slot.sequence.store(0);
+                }
+                layout->version.store(Layout::Version);
+                layout->magic.store(Layout::Magic, std::memory_order_release);
+            }
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Writes one frame, stamped with the current time. Never blocks. */
+        void publish(const float* quaternion, const float* matrix)
+        {
+            if (!layout) return;
+
+            const uint64_t n = layout->framesWritten.load(std::memory_order_relaxed);
+            Frame frame;
+            frame.frameNumber = n;
+            frame.timestampNanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch()).count());
+            std::memcpy(frame.quaternion, quaternion, sizeof(frame.quaternion));
+            std::memcpy(frame.matrix, matrix, sizeof(frame.matrix));
+
+            uint32_t words[Layout::FrameWords];
+            std::memcpy(words, &frame, sizeof(Frame));
+
+            Layout::Slot& slot = layout->slots[n % Layout::NumSlots];
+            const uint32_t s = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (uint32_t i = 0; i < Layout::FrameWords; ++i)
+            {
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            }
+            slot.sequence.store(s + 2, std::memory_order_release);
+            layout->framesWritten.store(n + 1, std::memory_order_release);
+        }
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Reads the latest frame. Wait-free: a read is only repeated if the
+        writer gets all the way round the ring during it, and gives up after
+        MaxAttempts of those. */
+    class Reader : public Mapping
+    {
+    public:
+        static constexpr int MaxAttempts = 4;
+
+        /** Returns false if there is no writer yet; try again later. */
+        bool open(const char* name = DefaultName)
+        {
+            if (!map(name, false))
+            {
+                return false;
+            }
+            if (layout->magic.load(std::memory_order_acquire) != Layout::Magic)
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** The number of frames published so far. Cheap: poll this to see
+            whether there is anything new. */
+        uint64_t getFramesWritten() const
+        {
+            return layout ? layout->framesWritten.load(std::memory_order_acquire) : 0;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Copies the most recent frame. Returns false if nothing has been
+            published yet or, very rarely, if the writer kept overwriting the
+            frame being read; either way, try again later. */
+        bool read(Frame& frame) const
+        {
+            if (!layout) return false;
+
+            for (int attempt = 0; attempt < MaxAttempts; ++attempt)
+            {
+                const uint64_t n = layout->framesWritten.load(std::memory_order_acquire);
+                if (n == 0)
+                {
+                    return false;
+                }
+                const Layout::Slot& slot = layout->slots[(n - 1) % Layout::NumSlots];
+                const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+                uint32_t words[Layout::FrameWords];
+                for (uint32_t i = 0; i < Layout::FrameWords; ++i)
+                {
+                    words[i] = slot.words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (!(before & 1) && (slot.sequence.load(std::memory_order_relaxed) == before))
+                {
+                    std::memcpy(&frame, words, sizeof(Frame));
+                    return true;
+                }
+                // the writer lapped us: start again from the newest frame
+            }
+            return false;
+        }
+    };
+};
@@ -13,6 +13,15 @@ public:
     enum class AngleMode { YPR, Quaternion, Matrix };
     enum class CompassState { Off, Calibrating, Succeeded, Failed, GoodData, BadData };
     enum class TravelMode { Off, Slow, Fast };
+    enum class Readback : uint8_t { Compass = 0x03, GestureAndChirality = 0x04, PullSpeed = 0x06, TravelMode = 0x11 };
+
+    static constexpr uint32_t readbackBit(const Readback parameter)
+    {
+        return 1u << static_cast<uint8_t>(parameter);
+    }
+
+    // compass, gesture and chirality, central pull speed, travel mode
+    static constexpr uint32_t DefaultReadbackMask = (1u << 0x03) | (1u << 0x04) | (1u << 0x06) | (1u << 0x11);
 
     // ------------------------------------------------------------------------
 
@@ -29,6 +38,7 @@ public:
         State() :
             rightEarChirality(false),
             compassOn(false),
+            compassSlowCorrection(false),
             gestureShakeToZero(false),
             pullSpeed(5),
             travelMode(TravelMode::Off),
@@ -59,6 +69,9 @@ public:
 
         /** Called when the gyroscope calibration has finished */
         virtual void trackerGyroCalibrated() {}
+
+        /** Called after each parameter of a readback reply has been stored */
+        virtual void trackerReadback(uint8_t /*parameter*/) {}
     };
 
     // ------------------------------------------------------------------------
@@ -222,17 +235,25 @@ public:
 
     /** Format a System Exclusive readback message.
         This message should be sent to the head tracker whenever it is newly connected:
-        this will refresh the Status object and notify the listener. */
-    size_t readbackMessage(uint8_t* buffer) const
+        this will refresh the Status object and notify the listener.
+        parameterMask selects the parameters to read (bit n requests parameter n,
+        see readbackBit); they are requested in ascending order. The default
+        set ends with the travel mode, whose arrival notifies the listener. */
+    size_t readbackMessage(uint8_t* buffer, uint32_t parameterMask = DefaultReadbackMask) const
     {
-        constexpr int MessageLength = 10;
-        supperwareSysex(buffer, MessageLength);
+        constexpr uint8_t MaxParameters = 10; // keeps the message within 16 bytes
+        uint8_t length = 5;
+        for (uint8_t parameter = 0; (parameter < 32) && (length < 5 + MaxParameters); ++parameter)
+        {
+            if (parameterMask & (1u << parameter))
+            {
+                buffer[length++] = parameter;
+            }
+        }
+        ++length; // trailing 0xf7
+        supperwareSysex(buffer, length);
         buffer[4] = 0x02; // Message 2 : Readback
-        buffer[5] = 0x03; // -- Magnetometer
-        buffer[6] = 0x04; // -- Gesture and chirality
-        buffer[7] = 0x06; // -- Central pull speed
-        buffer[7] = 0x11; // -- Travel mode
-        return MessageLength;
+        return length;
     }
 
     // ------------------------------------------------------------------------
@@ -278,6 +299,7 @@ public:
             for (uint8_t i = 4; i < numBytes; i += 2)
             {
                 processReadback(buffer[i], buffer[i+1]);
+                if (l) l->trackerReadback(buffer[i]);
             }
             return true;
         }
@@ -26,13 +26,14 @@ namespace ConfigPanel
             doRepaint(false)
         {
             setOpaque(false);
-            td.addListener(this);
+            td.addListener(this, Midi::Dispatch::MessageThread);
         }
 
         // ---------------------------------------------------------------------
 
         ~BasePanel()
         {
+            td.removeListener(this);
             for (auto tb : toggleButtons) { tb->setLookAndFeel(nullptr); }
         }
 
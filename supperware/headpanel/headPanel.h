@@ -6,11 +6,12 @@
 #pragma once
 #define HEADPANEL_H_INCLUDED
 
-#include "headpanel-PointList.h"
 #include "headpanel-Points.h"
+#include "headpanel-PointList.h"
 #include "headpanel-Plotter.h"
 
 // plugin GUI: not needed for Bridgehead
+#include "headpanel-RepaintScheduler.h"
 #include "headpanel-HeadButton.h"
 #include "headpanel-BinaryData.h"
 #include "headpanel-Component.h"
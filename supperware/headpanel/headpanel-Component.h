@@ -10,8 +10,12 @@ namespace HeadPanel
 {
     /** Component that manages head tracker settings, disconnection/reconnection, and shows 
       * instantaneous head angle. Also owns Midi::Tracker and SBR::HeadMatrix objects, which
-      * are useful everywhere else. */
-    class HeadPanel: public juce::Component, juce::Timer, Midi::TrackerDriver::Listener, HeadButton::Listener
+      * are useful everywhere else.
+      *
+      * The head is drawn while the tracker is connected, or while orientation is arriving
+      * from any other source fed to the driver (an Osc::OscReceiver, say). */
+    class HeadPanel: public juce::Component, RepaintScheduler::Client, Midi::TrackerDriver::Listener, HeadButton::Listener,
+                     private juce::Timer
 
     {
     public:
@@ -23,14 +27,18 @@ namespace HeadPanel
         };
 
         HeadPanel() :
+            RepaintScheduler::Client(static_cast<juce::Component&>(*this)),
             listener(nullptr),
             settingsPanel(trackerDriver),
             hbConfigure(this, 0),
             hbConnect(this, 1),
-            doRepaint(false),
             gazeInitial(0),
             gazeNow(0),
-            midiState(Midi::State::Unavailable)
+            midiState(Midi::State::Unavailable),
+            lastFrameTime(0.0),
+            live(false),
+            shownState(Midi::State::Unavailable),
+            repaintWholeHead(true)
         {
             juce::MemoryInputStream mis(BinaryData::mini_tile_png, BinaryData::mini_tile_pngSize, false);
             juce::Image im = juce::ImageFileFormat::loadFrom(mis);
@@ -49,6 +57,13 @@ namespace HeadPanel
             return trackerDriver;
         }
 
+        /** For feeding the panel from elsewhere: the driver is a Tracker::Listener,
+            so it can be given to an Osc::OscReceiver. */
+        Midi::TrackerDriver& getTrackerDriver()
+        {
+            return trackerDriver;
+        }
+
         //----------------------------------------------------------------------
 
         const HeadMatrix& getHeadMatrix() const
@@ -58,10 +73,11 @@ namespace HeadPanel
 
         //----------------------------------------------------------------------
 
+        /** Draws whatever getRepaintArea() last projected, so that the wireframe
+            never goes outside the area that was invalidated for it. */
         void paint(juce::Graphics& g) override
         {
-            constexpr int HeadSize = 48;
-            plot.paint(g, HeadSize + 50, HeadSize + 4, static_cast<float>(HeadSize), 2.0f, midiState);
+            plot.paint(g, HeadX, HeadY, static_cast<float>(HeadSize), LineThickness, shownState);
         }
 
         //----------------------------------------------------------------------
@@ -69,7 +85,8 @@ namespace HeadPanel
         void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
         {
             headMatrix.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
-            plot.recalculate(headMatrix);
+            noteFrame();
+            postMatrix();
             if (listener) listener->trackerChanged(headMatrix);
             flagRepaint();
         }
@@ -79,7 +96,8 @@ namespace HeadPanel
         void trackerOrientationQ(float qw, float qx, float qy, float qz) override
         {
             headMatrix.setOrientationQuaternion(qw, qx, qy, qz);
-            plot.recalculate(headMatrix);
+            noteFrame();
+            postMatrix();
             if (listener) listener->trackerChanged(headMatrix);
             flagRepaint();
         }
@@ -102,13 +120,16 @@ namespace HeadPanel
                     hbConnect.setVisible(true);
                     hbConnect.setSelected(false);
                     headMatrix.zero();
+                    displayHead.zero();
                 }
                 else // Unavailable
                 {
                     hbConnect.setVisible(false);
                     headMatrix.zero();
+                    displayHead.zero();
                 }
                 if (listener) listener->trackerChanged(headMatrix);
+                repaintWholeHead = true;
                 flagRepaint();
             }
         }
@@ -131,13 +152,14 @@ namespace HeadPanel
 
         void mouseDrag(const juce::MouseEvent& event) override
         {
-            if (midiState == Midi::State::Connected)
+            if (live)
             {
                 int s = event.getDistanceFromDragStartY();
                 gazeNow = gazeInitial - (s / 2.0f);
                 if (gazeNow > 90.0f) gazeNow = 90.0f;
                 if (gazeNow < 0.0f)  gazeNow = 0.0f;
                 plot.setGazeAngle(gazeNow);
+                repaintWholeHead = true;
                 flagRepaint();
             }
         }
@@ -171,12 +193,12 @@ namespace HeadPanel
                 // connect/disconnect button
                 if (midiState == Midi::State::Available)
                 {
-                    trackerDriver.connect();
+                    trackerDriver.connectAsync();
                     trackerDriver.turnOn(false, true);
                 }
                 else
                 {
-                    trackerDriver.disconnect();
+                    trackerDriver.disconnectAsync();
                 }
             }
         }
@@ -203,46 +225,138 @@ namespace HeadPanel
 
         //----------------------------------------------------------- ----------
 
-        void timerCallback() override
+        void setListener(Listener* l)
         {
-            stopTimer();
-            if (doRepaint)
-            {
-                juce::MessageManagerLock mml;
-                doRepaint = false;
-                repaint();
-            }
+            listener = l;
         }
 
         //----------------------------------------------------------- ----------
 
-        void setListener(Listener* l)
+        /** Draws the wireframe on a shared pool of worker threads, rather than
+            on the message thread: worthwhile with many panels on screen.
+            Call on the message thread. */
+        void setBackgroundRendering(const bool shouldRender)
         {
-            listener = l;
+            plot.setBackgroundRendering(shouldRender, [this]() { flagRepaint(); });
+            repaintWholeHead = true;
+            flagRepaint();
         }
 
     private:
+        static constexpr int HeadSize = 48;
+        static constexpr int HeadX = HeadSize + 50;
+        static constexpr int HeadY = HeadSize + 4;
+        static constexpr float LineThickness = 2.0f;
+        static constexpr double LiveMilliseconds = 600.0; // as the MIDI watchdog
+
         Listener* listener;
         Midi::TrackerDriver trackerDriver;
-        HeadMatrix headMatrix;
+        HeadMatrix headMatrix;       // MIDI thread
+        Midi::Mailbox<9> latestMatrix;
+        HeadMatrix displayHead;      // message thread: what was last painted
         ConfigPanel::SettingsPanel settingsPanel;
 
         HeadButton hbConfigure, hbConnect;
         HeadPlot plot;
-        bool doRepaint;
         float gazeInitial, gazeNow;
 
         Midi::State midiState;
+        std::atomic<double> lastFrameTime;          // from whichever thread delivers frames
+        bool live;                                  // message thread, as are the two below
+        Midi::State shownState;                     // what the plot draws: Connected while live
+        std::atomic<bool> repaintWholeHead;         // the backdrop has changed too
+        juce::Rectangle<int> paintedWireframe;      // message thread
+
+        //----------------------------------------------------------- ----------
+
+        /** On the thread that delivered a frame, whatever its source. */
+        void noteFrame()
+        {
+            lastFrameTime.store(juce::Time::getMillisecondCounterHiRes(), std::memory_order_relaxed);
+        }
+
+        /** Connected over MIDI, or hearing orientation from anywhere. */
+        bool isLive() const
+        {
+            if (midiState == Midi::State::Connected)
+            {
+                return true;
+            }
+            const double last = lastFrameTime.load(std::memory_order_relaxed);
+            return (last > 0.0) && ((juce::Time::getMillisecondCounterHiRes() - last) < LiveMilliseconds);
+        }
+
+        /** While live, checks now and then that frames are still arriving: a
+            network stream can stop without anything else happening. */
+        void timerCallback() override
+        {
+            flagRepaint();
+        }
+
+        /** Message thread: brings live and shownState up to date, and redraws
+            the whole head when they change. */
+        void updateLiveState()
+        {
+            const bool nowLive = isLive();
+            if (nowLive != live)
+            {
+                live = nowLive;
+                repaintWholeHead = true;
+                if (live)
+                {
+                    startTimer(static_cast<int>(LiveMilliseconds));
+                }
+                else
+                {
+                    stopTimer();
+                    displayHead.zero();
+                }
+            }
+            shownState = live ? Midi::State::Connected : midiState;
+        }
+
+        //----------------------------------------------------------- ----------
+
+        /** On the MIDI thread: hands the new orientation to the next frame,
+            which projects it only if the panel is showing. */
+        void postMatrix()
+        {
+            float matrix[9];
+            headMatrix.getMatrix(matrix);
+            latestMatrix.post(matrix);
+        }
 
         //----------------------------------------------------------- ----------
 
-        void flagRepaint()
+        /** Called by the RepaintScheduler just before repainting: projects
+            the latest orientation, and asks for only the area where the
+            wireframe was and now is. The buttons look after themselves. */
+        juce::Rectangle<int> getRepaintArea() override
         {
-            if (!doRepaint)
+            updateLiveState();
+            if (!isShowing())
+            {
+                return {};
+            }
+
+            float matrix[9];
+            if (latestMatrix.collect(matrix))
             {
-                doRepaint = true;
-                startTimer(20);
+                displayHead.setOrientationMatrix(matrix);
             }
+            plot.update(displayHead);
+
+            const juce::Rectangle<int> wireframe = live
+                ? plot.getWireframeArea(HeadX, HeadY, static_cast<float>(HeadSize), LineThickness)
+                : juce::Rectangle<int>();
+            // a new image at a new gaze moves the ellipse behind it too
+            const bool wholeHead = repaintWholeHead.exchange(false) || (live && plot.isBackdropStale());
+            const juce::Rectangle<int> area = wholeHead
+                ? juce::Rectangle<int>(HeadX - HeadSize, HeadY - HeadSize, 2 * HeadSize, 2 * HeadSize)
+                      .expanded(static_cast<int>(std::ceil(LineThickness)))
+                : paintedWireframe.getUnion(wireframe);
+            paintedWireframe = wireframe;
+            return area;
         }
     };
 };
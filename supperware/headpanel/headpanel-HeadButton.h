@@ -8,7 +8,7 @@
 
 namespace HeadPanel
 {
-    class HeadButton: public juce::Component, private juce::Timer
+    class HeadButton: public juce::Component, private RepaintScheduler::Client
     {
     public:
         class Listener
@@ -19,7 +19,8 @@ namespace HeadPanel
         };
 
         HeadButton(Listener* listener, int index) :
-            l(listener), im(), listenerIndex(index), isSelected(false), isHovering(false), doRepaint(false)
+            RepaintScheduler::Client(static_cast<juce::Component&>(*this)),
+            l(listener), im(), listenerIndex(index), isSelected(false), isHovering(false), spriteScale(0.0f)
         {
             setSize(40, 40);
         }
@@ -34,7 +35,14 @@ namespace HeadPanel
             /**/ if (isSelected) { g.setColour(juce::Colours::white); }
             else if (isHovering) { g.setColour(juce::Colour(0x80ffffff)); }
             else                 { g.setColour(juce::Colour(0x40ffffff)); }
-            g.drawImageWithin(im, 0, 0, 40, 40, juce::RectanglePlacement());
+
+            // the colour's alpha sets the image's opacity
+            const float pixelScale = g.getInternalContext().getPhysicalPixelScaleFactor();
+            if (pixelScale != spriteScale)
+            {
+                renderSprite(pixelScale);
+            }
+            g.drawImage(sprite, juce::Rectangle<float>(0.0f, 0.0f, 40.0f, 40.0f));
         }
 
         //----------------------------------------------------------------------
@@ -74,6 +82,7 @@ namespace HeadPanel
         {
             im = image;
             im.duplicateIfShared();
+            spriteScale = 0.0f;
         }
 
         //----------------------------------------------------------------------
@@ -93,28 +102,28 @@ namespace HeadPanel
 
         //----------------------------------------------------------------------
 
-        void timerCallback() override
-        {
-            stopTimer();
-            if (doRepaint)
-            {
-                doRepaint = false;
-                repaint();
-            }
-        }
-
-        //----------------------------------------------------------------------
-
     private:
         Listener* l;
         juce::Image im;
         int listenerIndex;
-        bool isSelected, isHovering, doRepaint;
+        bool isSelected, isHovering;
+        juce::Image sprite;     // im, already resampled to the display
+        float spriteScale;      // the pixel scale sprite was made for, or zero
 
         void repaintAsync()
         {
-            doRepaint = true;
-            startTimerHz(60);
+            flagRepaint();
+        }
+
+        /** Resamples the image once for each display density, so that painting
+            it is a straight copy. */
+        void renderSprite(const float pixelScale)
+        {
+            const int size = static_cast<int>(std::ceil(40.0f * pixelScale));
+            sprite = juce::Image(juce::Image::ARGB, size, size, true);
+            juce::Graphics g(sprite);
+            g.drawImageWithin(im, 0, 0, size, size, juce::RectanglePlacement());
+            spriteScale = pixelScale;
         }
     };
 };
@@ -8,106 +8,252 @@
 
 namespace HeadPanel
 {
+    /** The worker threads shared by every HeadPlot that renders in the
+        background: share it with juce::SharedResourcePointer<RasterPool>. */
+    class RasterPool : public juce::ThreadPool
+    {
+    public:
+        RasterPool() :
+            juce::ThreadPool(juce::jlimit(1, MaxThreads, juce::SystemStats::getNumCpus() - 1))
+        {}
+
+    private:
+        static constexpr int MaxThreads = 4;
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Projects the head on one thread and paints it on another, without
+        either ever waiting for the other. Frames are triple-buffered: the
+        projecting side fills a buffer that nobody else can see and swaps it
+        in as the latest in a single atomic exchange; the painting side swaps
+        that out in the same way, so it always draws the most recent complete
+        frame. update() and recalculate() must only be called from one thread
+        at a time, as must paint().
+
+        Everything behind the wireframe (the gaze ellipse, or the outline or
+        text shown when not connected) is rendered once into an image at the
+        display's pixel scale, and redrawn only when it changes.
+
+        Optionally, the wireframe itself can be drawn into an image on a
+        worker thread: see setBackgroundRendering(). */
     class HeadPlot
     {
     public:
         HeadPlot() :
-            pointList(),
-            cosGaze(1.0f),
-            sinGaze(0.0f)
+            gazeRadians(0.0f),
+            viewChanged(true),
+            plottedFrame(0),
+            back(2),
+            front(0),
+            backdropKey(),
+            backdropStale(false),
+            renderRequests(0),
+            rasterScale(0.0f),
+            rasterLineThickness(0.0f),
+            rasterPixelScale(0.0f),
+            rasterBack(2),
+            rasterFront(0),
+            latestRaster(1),
+            latest(1)
         {}
-        
-        // --------------------------------------------------------------------
 
-        /** Rotates head appropriately to a new position */
-        void recalculate(const HeadMatrix& headMatrix)
+        ~HeadPlot()
         {
-            juce::ScopedLock sl(calculateOrPaint);
-            pointList.clear();
-            uint8_t i;
+            setBackgroundRendering(false);
+        }
 
-            //neck-ring
-            for (i = 0; i < NeckRingCount; ++i)
-            {
-                project3D(NeckRing[i], headMatrix, false, false);
-            }
-            project3D(NeckRing[0], headMatrix, false, true);
+        // --------------------------------------------------------------------
 
-            //xy
-            for (i = XYCount - 1; i > 0; --i)
+        /** With this on, each projected frame is drawn into an image by a
+            small pool of worker threads shared with every other HeadPlot, and
+            paint() only copies the latest finished image. That spreads line
+            drawing across cores when there are many heads on screen.
+            onFrameRendered is called on a worker thread as each image is
+            finished, and must ask for a repaint. Switch on the thread that
+            projects and paints: to use this, those must be one and the same. */
+        void setBackgroundRendering(const bool shouldRender, std::function<void()> onFrameRendered = nullptr)
+        {
+            if (shouldRender == isRenderingInBackground())
             {
-                project3D(XY[i], headMatrix, true, false);
+                return;
             }
-            for (i = 0; i < XYCount; ++i)
+            if (shouldRender)
             {
-                project3D(XY[i], headMatrix, false, i == XYCount - 1); 
+                frameRendered = std::move(onFrameRendered);
+                pool.reset(new juce::SharedResourcePointer<RasterPool>());
             }
-
-            //xz
-            for (i = XZCount - 1; i > 0; --i)
+            else
             {
-                project3D(XZ[i], headMatrix, true, false);
+                // no job of ours may outlive us: drop any still queued behind
+                // other plots' work, and wait only for one already running
+                RenderJob::Selector ours(*this);
+                (*pool)->removeAllJobs(false, -1, &ours);
+                renderRequests.store(0, std::memory_order_release);
+                pool.reset();
+                frameRendered = nullptr;
+                backdropStale = false;
             }
-            for (i = 0; i < XZCount; ++i)
+        }
+
+        bool isRenderingInBackground() const { return pool != nullptr; }
+
+        // --------------------------------------------------------------------
+
+        /** Recalculates only if the head has moved, or the gaze has changed,
+            since last time: call just before painting, so that frames that are
+            never drawn are never projected. Returns true if it recalculated. */
+        bool update(const HeadMatrix& headMatrix)
+        {
+            if (!viewChanged.load(std::memory_order_relaxed) && (headMatrix.getFrameCount() == plottedFrame))
             {
-                project3D(XZ[i], headMatrix, false, i == XZCount - 1);
+                return false;
             }
+            recalculate(headMatrix);
+            return true;
+        }
+        
+        // --------------------------------------------------------------------
+
+        /** Rotates head appropriately to a new position, and publishes it to
+            the painting side. */
+        void recalculate(const HeadMatrix& headMatrix)
+        {
+            plottedFrame = headMatrix.getFrameCount();
+            viewChanged.store(false, std::memory_order_relaxed);
+            setView(headMatrix);
+            Frame& frame = frames[back];
+            frame.sinGaze = sinGaze;
+            PointList& pointList = frame.points;
+            pointList.clear();
+
+            //neck-ring, closed back to its first point
+            projectRun(pointList, NeckRing, 0, NeckRingCount - 1, false, false);
+            projectRun(pointList, NeckRing, 0, 0, false, true);
+
+            //xy: the mirrored half from the outside in, then the other half
+            projectRun(pointList, XY, XYCount - 1, 1, true, false);
+            projectRun(pointList, XY, 0, XYCount - 1, false, true);
+
+            //xz
+            projectRun(pointList, XZ, XZCount - 1, 1, true, false);
+            projectRun(pointList, XZ, 0, XZCount - 1, false, true);
 
             //yz
-            for (i = 0; i < YZCount; ++i)
-            {
-                project3D(YZ[i], headMatrix, false, i == YZCount - 1);
-            }
+            projectRun(pointList, YZ, 0, YZCount - 1, false, true);
 
             //hz1
-            for (i = 0; i < HZCount; ++i)
-            {
-                project3D(HZ[i], headMatrix, false, i == HZCount - 1);
-            }
+            projectRun(pointList, HZ, 0, HZCount - 1, false, true);
 
             //hz2
-            for (i = 0; i < HZCount; ++i)
+            projectRun(pointList, HZ, 0, HZCount - 1, true, true);
+
+            pointList.sortByDepth();
+            projectedBounds = pointList.getBounds(0.0f, 0.0f, 1.0f);
+
+            // release: the frame is complete before the painting side can take it
+            back = latest.exchange(static_cast<uint8_t>(back | Fresh), std::memory_order_acq_rel) & IndexMask;
+
+            if (pool)
             {
-                project3D(HZ[i], headMatrix, true, i == HZCount - 1);
+                requestRender();
             }
         }
 
         // --------------------------------------------------------------------
 
         void paint(juce::Graphics& g, const float xMid, const float yMid,
-            const float scale, const float lineThickness, const Midi::State connectionState) const
+            const float scale, const float lineThickness, const Midi::State connectionState)
         {
-            juce::Rectangle<float> bounds(xMid - scale, yMid - scale, 2.0f * scale, 2.0f * scale);
+            const bool connected = (connectionState == Midi::State::Connected);
+            const bool rendered = isRenderingInBackground();
+            if (connected && !rendered && (latest.load(std::memory_order_relaxed) & Fresh))
+            {
+                // take the latest frame if there's a new one; otherwise keep
+                // drawing the one we have
+                front = latest.exchange(front, std::memory_order_acq_rel) & IndexMask;
+            }
+            const float pixelScale = g.getInternalContext().getPhysicalPixelScaleFactor();
+            if (rendered)
+            {
+                // for the workers' next image
+                rasterScale.store(scale, std::memory_order_relaxed);
+                rasterLineThickness.store(lineThickness, std::memory_order_relaxed);
+                rasterPixelScale.store(pixelScale, std::memory_order_relaxed);
+            }
+            const float sinGazeShown = rendered ? rasters[rasterFront].sinGaze : frames[front].sinGaze;
 
-            if (connectionState == Midi::State::Bootloader)
+            const BackdropKey key { connectionState, connected ? sinGazeShown : 0.0f, scale, lineThickness, pixelScale };
+            if (!(key == backdropKey))
             {
-                g.setFont(juce::Font (15.0f));
-                g.setColour(juce::Colour(0xff808080));
-                g.drawText("BOOTLOADER", bounds, juce::Justification::centred);
+                renderBackdrop(key);
             }
-            else if (connectionState == Midi::State::Connected)
+            const float extent = scale + lineThickness;
+            g.setOpacity(1.0f);
+            g.drawImage(backdrop, juce::Rectangle<float>(xMid - extent, yMid - extent,
+                                                         backdrop.getWidth() / key.pixelScale,
+                                                         backdrop.getHeight() / key.pixelScale));
+
+            if (connected && rendered)
             {
-                juce::ScopedLock sl(calculateOrPaint);
-                g.setColour(juce::Colours::black);
-                g.fillEllipse(xMid - scale, yMid - (scale * sinGaze), scale * 2.0f, scale * sinGaze * 2.0f);
-                pointList.paint(g, static_cast<int>(xMid), static_cast<int>(yMid), scale, lineThickness);
+                const Raster& raster = rasters[rasterFront];
+                if (raster.pixelScale > 0.0f)
+                {
+                    g.drawImage(raster.image, juce::Rectangle<float>(xMid - raster.extent, yMid - raster.extent,
+                                                                     raster.image.getWidth() / raster.pixelScale,
+                                                                     raster.image.getHeight() / raster.pixelScale));
+                }
             }
-            else
+            else if (connected)
             {
-                g.setColour(juce::Colour(0xff282828));
-                g.drawEllipse(bounds, lineThickness);
+                frames[front].points.paint(g, static_cast<int>(xMid), static_cast<int>(yMid), scale, lineThickness,
+                                           DefaultHeatmap);
             }
         }
 
         // --------------------------------------------------------------------
 
-        /** Zero is a rear view; 90 is a plan view; you can have anything in-between */
+        /** The area that the wireframe covers when the next paint() draws it
+            with these arguments. Without background rendering, that's the
+            last frame projected, and this is called on the projecting side.
+            With it, this takes the latest finished image for paint(), and is
+            called on the painting side. */
+        juce::Rectangle<int> getWireframeArea(const float xMid, const float yMid,
+            const float scale, const float lineThickness)
+        {
+            if (isRenderingInBackground())
+            {
+                if (latestRaster.load(std::memory_order_relaxed) & Fresh)
+                {
+                    rasterFront = latestRaster.exchange(rasterFront, std::memory_order_acq_rel) & IndexMask;
+                }
+                const Raster& raster = rasters[rasterFront];
+                backdropStale = (raster.pixelScale > 0.0f) && (backdropKey.state == Midi::State::Connected)
+                             && (raster.sinGaze != backdropKey.sinGaze);
+                return raster.area.translated(static_cast<int>(xMid), static_cast<int>(yMid));
+            }
+            return juce::Rectangle<float>::leftTopRightBottom(xMid + projectedBounds.getX() * scale,
+                                                              yMid + projectedBounds.getY() * scale,
+                                                              xMid + projectedBounds.getRight() * scale,
+                                                              yMid + projectedBounds.getBottom() * scale)
+                .expanded(lineThickness).getSmallestIntegerContainer();
+        }
+
+        /** After getWireframeArea(), with background rendering: true if the image
+            it took was drawn at a different gaze from the backdrop last painted.
+            The gaze ellipse then moves too, beyond the wireframe's area, so the
+            whole head needs repainting. */
+        bool isBackdropStale() const { return backdropStale; }
+
+        // --------------------------------------------------------------------
+
+        /** Zero is a rear view; 90 is a plan view; you can have anything in-between.
+            Takes effect at the next update(), on whichever thread that runs. */
         void setGazeAngle(const float gazeDegrees)
         {
             // 0 to 90
-            float gazeRadians = gazeDegrees * juce::MathConstants<float>::pi / 180.0f;
-            sinGaze = sinf(gazeRadians);
-            cosGaze = cosf(gazeRadians);
+            gazeRadians.store(gazeDegrees * juce::MathConstants<float>::pi / 180.0f, std::memory_order_relaxed);
+            viewChanged.store(true, std::memory_order_relaxed);
         }
 
         // --------------------------------------------------------------------
@@ -125,30 +271,260 @@ namespace HeadPanel
 
         // --------------------------------------------------------------------
 
-        PointList pointList;
+        struct BackdropKey
+        {
+            Midi::State state = Midi::State::Unavailable;
+            float sinGaze = 0.0f;
+            float scale = 0.0f;         // zero until the first render
+            float lineThickness = 0.0f;
+            float pixelScale = 1.0f;
+
+            bool operator==(const BackdropKey& other) const
+            {
+                return (state == other.state) && (sinGaze == other.sinGaze) && (scale == other.scale)
+                    && (lineThickness == other.lineThickness) && (pixelScale == other.pixelScale);
+            }
+        };
+
+        struct Raster
+        {
+            juce::Image image;
+            juce::Rectangle<int> area;  // the wireframe's, about the head's centre
+            float sinGaze = 0.0f;
+            int extent = 0;             // from the head's centre to the image's edge
+            float pixelScale = 0.0f;    // zero until first drawn
+        };
+
+        struct Frame
+        {
+            PointList points;
+            float sinGaze = 0.0f;   // for the ellipse drawn behind the head
+        };
+
+        static constexpr uint8_t IndexMask = 3;
+        static constexpr uint8_t Fresh = 4;     // set when latest hasn't been painted
+
+        std::atomic<float> gazeRadians;
+        std::atomic<bool> viewChanged;
+
+        // projecting side only
         float cosGaze, sinGaze;
-        juce::CriticalSection calculateOrPaint;
+        uint32_t plottedFrame;
+        uint8_t back;
+        juce::Rectangle<float> projectedBounds;   // at unit scale, about the origin
+
+        // painting side only
+        uint8_t front;
+        juce::Image backdrop;
+        BackdropKey backdropKey;
+        bool backdropStale;
+
+        // background rendering: the workers are the only ones to take frames
+        // from latest, and pass finished images on through latestRaster
+        std::unique_ptr<juce::SharedResourcePointer<RasterPool>> pool;
+        std::function<void()> frameRendered;
+        std::atomic<int> renderRequests;
+        std::atomic<float> rasterScale, rasterLineThickness, rasterPixelScale;
+        uint8_t rasterBack;                 // workers only
+        uint8_t rasterFront;                // painting side only
+        std::atomic<uint8_t> latestRaster;
+        Raster rasters[3];
+
+        // the one index the two sides share: each buffer is always exactly one
+        // of back, front or latest
+        std::atomic<uint8_t> latest;
+        Frame frames[3];
+
+        // the head's rotation followed by the gaze tilt, row-major: view[1]
+        // projects the geometry as stored, and view[0] mirrors it in x
+        float view[2][9];
+
+        // --------------------------------------------------------------------
+        //                                                 BACKGROUND RENDERING
+        // --------------------------------------------------------------------
+
+        /** One render on a worker, owned and deleted by the pool. Each plot's
+            jobs can be picked out with a Selector, to cancel them. */
+        class RenderJob : public juce::ThreadPoolJob
+        {
+        public:
+            RenderJob(HeadPlot& owner) : juce::ThreadPoolJob("Head render"), plot(owner) {}
+
+            JobStatus runJob() override
+            {
+                plot.renderRequested();
+                return jobHasFinished;
+            }
+
+            struct Selector : public juce::ThreadPool::JobSelector
+            {
+                Selector(const HeadPlot& owner) : plot(owner) {}
+                bool isJobSuitable(juce::ThreadPoolJob* job) override
+                {
+                    const RenderJob* r = dynamic_cast<const RenderJob*>(job);
+                    return (r != nullptr) && (&r->plot == &plot);
+                }
+                const HeadPlot& plot;
+            };
+
+        private:
+            HeadPlot& plot;
+        };
+
+        /** Only the first request while none are outstanding starts a job: a
+            worker already running sees the rest, and renders once for all
+            of them. */
+        void requestRender()
+        {
+            if (renderRequests.fetch_add(1, std::memory_order_acq_rel) == 0)
+            {
+                (*pool)->addJob(new RenderJob(*this), true);
+            }
+        }
+
+        void renderRequested()
+        {
+            for (int n = renderRequests.load(std::memory_order_acquire); ; )
+            {
+                renderLatest();
+                const int remaining = renderRequests.fetch_sub(n, std::memory_order_acq_rel) - n;
+                if (remaining == 0)
+                {
+                    return;
+                }
+                n = remaining;
+            }
+        }
+
+        // --------------------------------------------------------------------
+
+        /** On a worker: draws the latest projected frame into an image, at the
+            size and pixel scale that paint() last used. */
+        void renderLatest()
+        {
+            const float scale = rasterScale.load(std::memory_order_relaxed);
+            const float lineThickness = rasterLineThickness.load(std::memory_order_relaxed);
+            const float pixelScale = rasterPixelScale.load(std::memory_order_relaxed);
+            if ((pixelScale <= 0.0f) || !(latest.load(std::memory_order_relaxed) & Fresh))
+            {
+                return; // not painted yet, or nothing new
+            }
+            front = latest.exchange(front, std::memory_order_acq_rel) & IndexMask;
+            const Frame& frame = frames[front];
+
+            Raster& raster = rasters[rasterBack];
+            const int extent = static_cast<int>(std::ceil(scale + lineThickness));
+            const int size = std::max(1, static_cast<int>(std::ceil(2.0f * extent * pixelScale)));
+            if ((raster.image.getWidth() != size) || (raster.image.getHeight() != size))
+            {
+                raster.image = juce::Image(juce::Image::ARGB, size, size, true, juce::SoftwareImageType());
+            }
+            else
+            {
+                raster.image.clear(raster.image.getBounds());
+            }
+            {
+                juce::Graphics g(raster.image);
+                g.addTransform(juce::AffineTransform::scale(pixelScale));
+                frame.points.paint(g, extent, extent, scale, lineThickness, DefaultHeatmap);
+            }
+            raster.area = frame.points.getBounds(0.0f, 0.0f, scale).expanded(lineThickness).getSmallestIntegerContainer();
+            raster.sinGaze = frame.sinGaze;
+            raster.extent = extent;
+            raster.pixelScale = pixelScale;
+
+            rasterBack = latestRaster.exchange(static_cast<uint8_t>(rasterBack | Fresh), std::memory_order_acq_rel) & IndexMask;
+            if (frameRendered)
+            {
+                frameRendered();
+            }
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Draws everything that goes behind the wireframe into an image
+            just big enough for it, at the display's own pixel density, so that
+            painting it is a straight copy. */
+        void renderBackdrop(const BackdropKey& key)
+        {
+            const float extent = key.scale + key.lineThickness;
+            const int size = static_cast<int>(std::ceil(2.0f * extent * key.pixelScale));
+            backdrop = juce::Image(juce::Image::ARGB, std::max(1, size), std::max(1, size), true);
+            backdropKey = key;
+
+            juce::Graphics g(backdrop);
+            g.addTransform(juce::AffineTransform::scale(key.pixelScale));
+            const juce::Rectangle<float> bounds(key.lineThickness, key.lineThickness, 2.0f * key.scale, 2.0f * key.scale);
+
+            if (key.state == Midi::State::Bootloader)
+            {
+                g.setFont(juce::Font (15.0f));
+                g.setColour(juce::Colour(0xff808080));
+                g.drawText("BOOTLOADER", bounds, juce::Justification::centred);
+            }
+            else if (key.state == Midi::State::Connected)
+            {
+                g.setColour(juce::Colours::black);
+                g.fillEllipse(key.lineThickness, extent - (key.scale * key.sinGaze),
+                              key.scale * 2.0f, key.scale * key.sinGaze * 2.0f);
+            }
+            else
+            {
+                g.setColour(juce::Colour(0xff282828));
+                g.drawEllipse(bounds, key.lineThickness);
+            }
+        }
 
         // --------------------------------------------------------------------
         //                                                        3D PROJECTION
         // --------------------------------------------------------------------
 
-        void project3D(const V3 v, const HeadMatrix& headMatrix,
-            const bool flipX, const bool closeLine)
+        /** Combines the head's rotation and the gaze tilt into one matrix per
+            frame, so that each point takes a single 3x3 multiply. */
+        void setView(const HeadMatrix& headMatrix)
         {
-            juce::Vector3D<float> t(flipX ? v[0] : -v[0], v[1], v[2]);
-            headMatrix.transform(t.x, t.y, t.z);
+            const float gaze = gazeRadians.load(std::memory_order_relaxed);
+            sinGaze = sinf(gaze);
+            cosGaze = cosf(gaze);
+            float r[9];
+            headMatrix.getMatrix(r);
+            for (int c = 0; c < 3; ++c)
+            {
+                view[1][c]     = r[c];
+                view[1][3 + c] = cosGaze * r[3 + c] - sinGaze * r[6 + c];
+                view[1][6 + c] = cosGaze * r[6 + c] + sinGaze * r[3 + c];
+            }
+            for (int i = 0; i < 9; ++i)
+            {
+                view[0][i] = (i % 3 == 0) ? -view[1][i] : view[1][i];
+            }
+        }
 
-            float ty  = cosGaze * t.y - sinGaze * t.z;
-            t.z       = cosGaze * t.z + sinGaze * t.y;
-            t.y = ty;
+        // --------------------------------------------------------------------
 
-            int tempInten = static_cast<int>(8.8f * (1.0f - ty));
-            juce::Colour c = (tempInten < 0) ? DefaultHeatmap[0] :
-                       (tempInten >= Heatmap_Count) ? DefaultHeatmap[Heatmap_Count - 1] :
-                        DefaultHeatmap[tempInten];
+        /** Projects source[first] to source[last] inclusive (counting down if
+            last < first), closing the line after the last if asked. */
+        void projectRun(PointList& pointList, const V3* source, const int first, const int last,
+            const bool flipX, const bool closeAtEnd)
+        {
+            const float* m = view[flipX ? 1 : 0];
+            const int step = (last >= first) ? 1 : -1;
+            for (int i = first; ; i += step)
+            {
+                const float* v = source[i];
+                const float x = m[0] * v[0] + m[1] * v[1] + m[2] * v[2];
+                const float y = m[3] * v[0] + m[4] * v[1] + m[5] * v[2];
+                const float z = m[6] * v[0] + m[7] * v[1] + m[8] * v[2];
 
-            pointList.addPoint(t.x, t.y, t.z, c, closeLine);
+                const int tempInten = static_cast<int>(8.8f * (1.0f - y));
+                const uint8_t heatIndex = static_cast<uint8_t>(juce::jlimit(0, Heatmap_Count - 1, tempInten));
+
+                pointList.addPoint(x, y, z, heatIndex, closeAtEnd && (i == last));
+                if (i == last)
+                {
+                    break;
+                }
+            }
         }
     };
 };
@@ -1,6 +1,6 @@
 /*
  * Head tracker panel and driver API
- * Z-buffered linked list for storing points and drawing wireframes
+ * Depth-sorted list for storing points and drawing wireframes
  * Copyright (c) 2021 Supperware Ltd.
  */
 
@@ -8,135 +8,177 @@
 
 namespace HeadPanel
 {
+    /** Holds one frame of projected wireframe points. Each point, unless it
+        closes a line, starts a segment to the point after it. Once every point
+        has been added, sortByDepth() puts the segments in painting order
+        (furthest first) with a single counting sort.
+
+        Points are stored as separate arrays of each field (only x and z are
+        needed to draw, and depth only to sort), and colours as an index into
+        the painter's heat map, looked up when drawing. */
     class PointList
     {
     public:
-        
-        struct PointItem
-        {
-            PointItem(float _x, float _y, float _z, juce::Colour _colour, bool _closeLine):
-                x(_x),
-                y(_y),
-                z(_z),
-                colour(_colour),
-                linkForwards(-1),
-                linkBackwards(-1),
-                closeLine(_closeLine)
-            {}
-
-            float x, y, z;
-            juce::Colour colour;
-            signed int linkForwards, linkBackwards;
-            bool closeLine;
-        };
-        
-        // ------------------------------------------------------------------------
+        /** Every point that HeadPlot::recalculate() adds: the neck ring and its
+            closing point, both halves of the XY and XZ outlines (sharing their
+            centre point), YZ, and HZ twice. */
+        static constexpr int Capacity = (NeckRingCount + 1) + (2 * XYCount - 1) + (2 * XZCount - 1)
+                                      + YZCount + (2 * HZCount);
 
         PointList() :
-            points(),
-            rearItem(-1)
+            numPoints(0),
+            numSegments(0),
+            minX(0.0f), maxX(0.0f), minZ(0.0f), maxZ(0.0f)
         {
-            points.reserve(200); // approximate size of the wireframe head
+            batch.preallocateSpace(FloatsPerSegment * Capacity);
         }
 
         // ------------------------------------------------------------------------
 
         void clear()
         {
-            points.clear();
-            rearItem = -1;
+            numPoints = 0;
+            numSegments = 0;
+            minX = maxX = minZ = maxZ = 0.0f;
         }
 
         // ------------------------------------------------------------------------
 
-        void addPoint(const float x, const float y, float z, const juce::Colour colour, const bool closeLine)
+        /** heatIndex selects a colour from the heat map given to paint(). */
+        void addPoint(const float x, const float y, const float z, const uint8_t heatIndex, const bool closeLine)
         {
-            points.push_back(PointItem(x, y, z, colour, closeLine));
-            PointItem* p = &points[points.size() - 1];
-            int thisIndex = static_cast<int>(points.size() - 1);
-
-            // insert into linked list, sorted according to y descending
-            // (so rear item has the highest y), using the previous point
-            // as a starting place
-            if (rearItem < 0)
+            jassert(numPoints < Capacity); // the wireframe has grown: see Capacity
+            if (numPoints >= Capacity)
+            {
+                return;
+            }
+            if (numPoints == 0)
             {
-                rearItem = 0;
+                minX = maxX = x;
+                minZ = maxZ = z;
             }
             else
             {
-                int prevIndex, nextIndex;
-                findSurroundingPoints(thisIndex, prevIndex, nextIndex);
-
-                p->linkBackwards = prevIndex;
-                p->linkForwards = nextIndex;
-                if (prevIndex >= 0) { points[prevIndex].linkForwards  = thisIndex; }
-                if (nextIndex >= 0) { points[nextIndex].linkBackwards = thisIndex; }
-                else { rearItem = thisIndex; }
+                minX = std::min(minX, x);
+                maxX = std::max(maxX, x);
+                minZ = std::min(minZ, z);
+                maxZ = std::max(maxZ, z);
             }
+            xs[numPoints] = x;
+            zs[numPoints] = z;
+            depths[numPoints] = quantiseDepth(y);
+            heat[numPoints] = heatIndex;
+            closesLine[numPoints] = closeLine;
+            ++numPoints;
         }
 
         // ------------------------------------------------------------------------
 
-        void paint(juce::Graphics& g, const int xMid, const int yMid, const float scale, const float lineThickness) const
+        /** Orders the segments from the rear (highest y) forwards. y is
+            quantised into DepthBuckets slices, which is far finer than a line's
+            thickness at any size the head is drawn; within a slice, segments
+            keep the order in which they were added. */
+        void sortByDepth()
         {
-            int index = rearItem;
-            while (index != -1)
+            std::array<uint16_t, DepthBuckets + 1> start {};
+
+            // the last point can't start a segment: it has nothing to join to
+            for (int i = 0; i < numPoints - 1; ++i)
+            {
+                if (!closesLine[i])
+                {
+                    ++start[depths[i] + 1];
+                }
+            }
+            for (int b = 0; b < DepthBuckets; ++b)
+            {
+                start[b + 1] += start[b];
+            }
+            numSegments = start[DepthBuckets];
+            for (int i = 0; i < numPoints - 1; ++i)
             {
-                const PointItem* p1 = &points[index];
-                if (!p1->closeLine)
+                if (!closesLine[i])
                 {
-                    /* The connecting point is always added to the list in sequence.
-                       If we went backwards through the linked list here, our next point
-                       would not necessarily be related to this line ... */
-                    const PointItem* p2 = &points[index + 1];
-                    g.setColour(p1->colour);
-                    g.drawLine(xMid + p1->x * scale, yMid - p1->z * scale,
-                               xMid + p2->x * scale, yMid - p2->z * scale, lineThickness);
+                    order[start[depths[i]]++] = static_cast<uint16_t>(i);
                 }
-                index = p1->linkBackwards;
             }
         }
 
         // ------------------------------------------------------------------------
 
-        void findSurroundingPoints(const int thisIndex, int& prevIndex, int& nextIndex)
+        /** The smallest rectangle that holds every point, once projected
+            as paint() does, but before allowing for line thickness. */
+        juce::Rectangle<float> getBounds(const float xMid, const float yMid, const float scale) const
         {
-            float depth = points[thisIndex].y;
+            return juce::Rectangle<float>::leftTopRightBottom(xMid + minX * scale, yMid - maxZ * scale,
+                                                              xMid + maxX * scale, yMid - minZ * scale);
+        }
 
-            prevIndex = -1;
-            nextIndex = -1;
+        // ------------------------------------------------------------------------
 
-            // use the previously-placed point as a starting point
-            int i = static_cast<int>(points.size()) - 2;
-            if (i >= 0)
+        /** heatmap holds the colours that the points' heat indices refer to.
+            The heat index rises towards the front of the head, as does the
+            painting order, so the segments fall into runs of one colour. Each run
+            is built into a single path and filled in one go: the same shapes
+            that drawLine() would fill, at the cost of one fill per colour rather
+            than one per segment. */
+        void paint(juce::Graphics& g, const int xMid, const int yMid, const float scale, const float lineThickness,
+                   const juce::Colour* heatmap) const
+        {
+            batch.clear();
+            int currentHeat = -1;
+            for (int s = 0; s < numSegments; ++s)
             {
-                if (points[i].y > depth)
+                const int i = order[s];
+                if (heat[i] != currentHeat)
                 {
-                    // traverse backwards
-                    while ((i >= 0) && (points[i].y > depth))
-                    {
-                        nextIndex = i;
-                        i = points[i].linkBackwards;
-                    }
-                    prevIndex = i;
-                }
-                else
-                {
-                    // traverse forwards
-                    while ((i >= 0) && (points[i].y <= depth))
-                    {
-                        prevIndex = i;
-                        i = points[i].linkForwards;
-                    }
-                    nextIndex = i;
+                    fillBatch(g, heatmap, currentHeat);
+                    currentHeat = heat[i];
                 }
+                batch.addLineSegment(juce::Line<float>(xMid + xs[i] * scale, yMid - zs[i] * scale,
+                                                       xMid + xs[i + 1] * scale, yMid - zs[i + 1] * scale),
+                                     lineThickness);
             }
+            fillBatch(g, heatmap, currentHeat);
         }
 
         // ------------------------------------------------------------------------
 
     private:
-        std::vector<PointItem> points;
-        int rearItem;
+        static constexpr int DepthBuckets = 256;
+        static constexpr float DepthRange = 1.25f; // the head fits within +/- 1 after rotation
+        static constexpr int FloatsPerSegment = 13;  // what Path::addLineSegment() adds
+
+        // no allocation, ever
+        std::array<float, Capacity> xs, zs;
+        std::array<uint8_t, Capacity> depths;   // quantised y: 0 is the rear
+        std::array<uint8_t, Capacity> heat;
+        std::array<bool, Capacity> closesLine;
+        std::array<uint16_t, Capacity> order;   // segment start points, rear first
+        int numPoints;
+        int numSegments;
+        float minX, maxX, minZ, maxZ;
+        mutable juce::Path batch;               // preallocated for every segment at once
+
+        // ------------------------------------------------------------------------
+
+        void fillBatch(juce::Graphics& g, const juce::Colour* heatmap, const int heatIndex) const
+        {
+            if (!batch.isEmpty())
+            {
+                g.setColour(heatmap[heatIndex]);
+                g.fillPath(batch);
+                batch.clear();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Bucket 0 is the rear. */
+        static uint8_t quantiseDepth(const float y)
+        {
+            const int b = static_cast<int>((DepthRange - y) * (DepthBuckets / (2.0f * DepthRange)));
+            return static_cast<uint8_t>(juce::jlimit(0, DepthBuckets - 1, b));
+        }
     };
 };
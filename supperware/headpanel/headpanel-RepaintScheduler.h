@@ -0,0 +1,194 @@
+/*
+ * Head tracker panel and driver API
+ * Process-wide coalescing of repaints into one capped frame clock
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace HeadPanel
+{
+    /** One frame clock for every head panel and button in the process, so that
+        a host with many editors open runs one timer rather than one per
+        component. Components ask for a repaint by flagging themselves, from any
+        thread: that's a single atomic exchange, and never touches the timer.
+        On each tick, every flagged component is repainted once, however often
+        it was flagged, and only within the area it reports.
+
+        The clock stops itself after a few idle frames, and is restarted by the
+        next flag through an AsyncUpdater, so nothing ticks while nothing moves.
+
+        Components take part by deriving from RepaintScheduler::Client; the
+        scheduler itself is shared with juce::SharedResourcePointer, and
+        created on the message thread when the first client is. */
+    class RepaintScheduler : private juce::Timer, private juce::AsyncUpdater
+    {
+    public:
+        static constexpr int DefaultFramesPerSecond = 60;
+
+        class Client
+        {
+        public:
+            /** On the message thread. */
+            Client(juce::Component& componentToRepaint) :
+                component(componentToRepaint),
+                dirty(false)
+            {
+                scheduler->addClient(this);
+            }
+
+            virtual ~Client()
+            {
+                scheduler->removeClient(this);
+            }
+
+            /** Asks for a repaint at the next frame. Safe from any thread. */
+            void flagRepaint()
+            {
+                // seq_cst, with wake(): see timerCallback()
+                if (!dirty.exchange(true, std::memory_order_seq_cst))
+                {
+                    scheduler->wake();
+                }
+            }
+
+        protected:
+            /** Called on the message thread just before repainting: the part
+                of the component that needs it. The whole component by default. */
+            virtual juce::Rectangle<int> getRepaintArea()
+            {
+                return component.getLocalBounds();
+            }
+
+        private:
+            friend class RepaintScheduler;
+            juce::Component& component;
+            std::atomic<bool> dirty;
+            juce::SharedResourcePointer<RepaintScheduler> scheduler;
+        };
+
+        // ------------------------------------------------------------------------
+
+        RepaintScheduler() :
+            framesPerSecond(DefaultFramesPerSecond),
+            idleFrames(0),
+            sleeping(true)
+        {}
+
+        ~RepaintScheduler()
+        {
+            stopTimer();
+            cancelPendingUpdate();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The most repaints per second that any client gets. On the message
+            thread. */
+        void setMaximumFrameRate(const int newFramesPerSecond)
+        {
+            framesPerSecond = juce::jlimit(1, 240, newFramesPerSecond);
+            if (isTimerRunning())
+            {
+                startTimerHz(framesPerSecond);
+            }
+        }
+
+        int getMaximumFrameRate() const { return framesPerSecond; }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int IdleFramesBeforeSleep = 8;
+
+        juce::Array<Client*> clients;   // message thread only
+        int framesPerSecond;
+        int idleFrames;
+        std::atomic<bool> sleeping;
+
+        // ------------------------------------------------------------------------
+
+        void addClient(Client* client)    { clients.addIfNotAlreadyThere(client); }
+        void removeClient(Client* client) { clients.removeFirstMatchingValue(client); }
+
+        // ------------------------------------------------------------------------
+
+        /** Any thread: only the first flag after the clock has stopped posts a
+            message to restart it. */
+        void wake()
+        {
+            if (sleeping.exchange(false, std::memory_order_seq_cst))
+            {
+                triggerAsyncUpdate();
+            }
+        }
+
+        void handleAsyncUpdate() override
+        {
+            idleFrames = 0;
+            startTimerHz(framesPerSecond);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void timerCallback() override
+        {
+            if (repaintFlagged())
+            {
+                idleFrames = 0;
+                return;
+            }
+            if (++idleFrames < IdleFramesBeforeSleep)
+            {
+                return;
+            }
+
+            stopTimer();
+            // a flag set while the clock was stopping saw it still awake, and
+            // didn't wake it: catch that here. This store and the loads in
+            // anyFlagged() pair with the flagger's exchanges of dirty then
+            // sleeping, and all are seq_cst so that at least one side sees the
+            // other's write (acquire/release would let the store pass the loads)
+            sleeping.store(true, std::memory_order_seq_cst);
+            if (anyFlagged() && sleeping.exchange(false, std::memory_order_seq_cst))
+            {
+                idleFrames = 0;
+                startTimerHz(framesPerSecond);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool repaintFlagged()
+        {
+            bool repainted = false;
+            for (Client* c : clients)
+            {
+                if (c->dirty.exchange(false, std::memory_order_acq_rel))
+                {
+                    const juce::Rectangle<int> area = c->getRepaintArea();
+                    if (!area.isEmpty())
+                    {
+                        c->component.repaint(area);
+                    }
+                    repainted = true;
+                }
+            }
+            return repainted;
+        }
+
+        bool anyFlagged() const
+        {
+            for (const Client* c : clients)
+            {
+                if (c->dirty.load(std::memory_order_seq_cst))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RepaintScheduler)
+    };
+};
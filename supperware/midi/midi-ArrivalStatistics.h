@@ -0,0 +1,113 @@
+/*
+ * MIDI drivers
+ * Measures the rate of a stream of frames as they arrive
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Learns the usual time between frames of a stream, and how much it varies. noteArrival() is called
+        by the thread that receives the frames, and is the only writer; the other
+        methods may be called from any thread. Times are in milliseconds, on
+        whatever clock the caller uses (normally
+        juce::Time::getMillisecondCounterHiRes()). */
+    class ArrivalStatistics
+    {
+    public:
+        ArrivalStatistics() :
+            resetPending(false),
+            count(0),
+            lastArrival(0.0),
+            interval(0.0),
+            jitter(0.0)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** Forgets the rate: for when the stream stops or changes. Any thread: the
+            getters behave as if reset straight away, but the statistics are only
+            cleared by the receiving thread, at its next noteArrival(). */
+        void reset()
+        {
+            resetPending.store(true, std::memory_order_release);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void noteArrival(const double now)
+        {
+            if (resetPending.exchange(false, std::memory_order_acq_rel))
+            {
+                count.store(0, std::memory_order_relaxed);
+                interval.store(0.0, std::memory_order_relaxed);
+                jitter.store(0.0, std::memory_order_relaxed);
+            }
+            const uint32_t n = count.load(std::memory_order_relaxed);
+            if (n > 0)
+            {
+                const double gap = now - lastArrival.load(std::memory_order_relaxed);
+                const double average = interval.load(std::memory_order_relaxed);
+                if (n == 1)
+                {
+                    interval.store(gap, std::memory_order_relaxed);
+                }
+                else if (gap < OutlierRatio * average)
+                {
+                    // a long gap is a pause in the stream, not a change of rate
+                    interval.store(average + (gap - average) * Smoothing, std::memory_order_relaxed);
+                    const double deviation = jitter.load(std::memory_order_relaxed);
+                    jitter.store(deviation + (std::abs(gap - average) - deviation) * Smoothing, std::memory_order_relaxed);
+                }
+            }
+            lastArrival.store(now, std::memory_order_release);
+            if (n < MinimumFrames)
+            {
+                count.store(n + 1, std::memory_order_release);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The average time between frames, or zero until enough have arrived. */
+        double getInterval() const
+        {
+            if (resetPending.load(std::memory_order_acquire))
+            {
+                return 0.0;
+            }
+            return (count.load(std::memory_order_acquire) >= MinimumFrames) ? interval.load(std::memory_order_relaxed) : 0.0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The average difference between each gap and getInterval(), or zero
+            until the interval is known. */
+        double getJitter() const
+        {
+            return (getInterval() > 0.0) ? jitter.load(std::memory_order_relaxed) : 0.0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** When the last frame arrived, or zero if none has since reset(). */
+        double getLastArrival() const
+        {
+            return resetPending.load(std::memory_order_acquire) ? 0.0 : lastArrival.load(std::memory_order_acquire);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr uint32_t MinimumFrames = 8;
+        static constexpr double Smoothing = 1.0 / 16.0;
+        static constexpr double OutlierRatio = 8.0;
+
+        std::atomic<bool> resetPending;
+        std::atomic<uint32_t> count;
+        std::atomic<double> lastArrival;
+        std::atomic<double> interval;
+        std::atomic<double> jitter;
+    };
+};
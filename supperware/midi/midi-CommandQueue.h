@@ -0,0 +1,245 @@
+/*
+ * MIDI drivers
+ * Coalescing outbound message queue, drained by a sender thread
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Each kind of outgoing message has one slot in the queue. */
+    enum class Command
+    {
+        Power, Chirality, Gesture, Compass, PullSpeed, TravelMode,
+        Zero, CalibrateCompass, NumCommands
+    };
+
+    /** Outgoing messages are posted into preallocated slots, one per Command,
+        and a sender thread (the queue's own, or one shared with other queues)
+        passes them to the MIDI output as soon as it is woken. A message that
+        replaces an unsent one for the same command wins, so a slider being
+        dragged sends its latest value rather than every value. Waiting
+        commands go out in the order they were last posted, so that a zero
+        can't overtake configuration sent before it; any readback follows
+        them, merged into a single message.
+
+        post() never spins, blocks on another poster, or allocates. The first
+        post since the sender last ran wakes it through its thread event,
+        which takes that event's mutex for an instant (the sender never holds
+        it while sending); later ones only set flags. */
+    class CommandQueue : private WorkerThread::Job
+    {
+    public:
+        static constexpr size_t MaxMessageBytes = 16;
+
+        CommandQueue(MidiDuplex& midiDuplex, const Tracker& trackerFormatter, WorkerThread* sharedSenderThread = nullptr) :
+            duplex(midiDuplex),
+            tracker(trackerFormatter),
+            ownSender(sharedSenderThread ? nullptr : new WorkerThread("Head tracker output")),
+            sender(sharedSenderThread ? *sharedSenderThread : *ownSender),
+            readbackMask(0),
+            nextStamp(0)
+        {
+            for (Slot& slot: slots)
+            {
+                slot.sequence.store(0);
+                slot.pending.store(false);
+                slot.numBytes.store(0);
+                slot.stamp.store(0);
+            }
+            sender.add(this);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~CommandQueue()
+        {
+            sender.remove(this);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Stores a message for the sender thread, replacing any unsent message
+            for the same command, and wakes the sender. If another thread is
+            posting the same command at this very moment, one of the two
+            messages is kept and the other dropped, exactly as if it had been
+            posted a moment earlier and then replaced: in that case this
+            returns false. */
+        bool post(const Command command, const uint8_t* message, const size_t numBytes)
+        {
+            jassert(numBytes <= MaxMessageBytes);
+            Slot& slot = slots[static_cast<size_t>(command)];
+
+            // an odd sequence means another poster is part-way through: rather
+            // than wait for it, let it win
+            uint32_t s = slot.sequence.load(std::memory_order_relaxed);
+            do
+            {
+                if (s & 1)
+                {
+                    return false;
+                }
+            } while (!slot.sequence.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_release);
+
+            for (size_t w = 0; w < NumWords; ++w)
+            {
+                uint32_t word = 0;
+                for (size_t b = 0; b < 4; ++b)
+                {
+                    const size_t i = 4 * w + b;
+                    if (i < numBytes) word |= static_cast<uint32_t>(message[i]) << (8 * b);
+                }
+                slot.words[w].store(word, std::memory_order_relaxed);
+            }
+            slot.numBytes.store(static_cast<uint8_t>(numBytes), std::memory_order_relaxed);
+            slot.stamp.store(nextStamp.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            slot.sequence.store(s + 2, std::memory_order_release);
+            slot.pending.store(true, std::memory_order_release);
+            sender.wake(*this);
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sends the last message posted for this command again, if there was one:
+            used to restore the configuration after reconnecting. Call flush()
+            afterwards. */
+        void repost(const Command command)
+        {
+            Slot& slot = slots[static_cast<size_t>(command)];
+            if (slot.numBytes.load() > 0)
+            {
+                slot.stamp.store(nextStamp.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                slot.pending.store(true, std::memory_order_release);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Asks for a readback of the parameters in parameterMask (see
+            Tracker::readbackBit), sent after any waiting commands when the
+            sender is next woken. */
+        void postReadback(const uint32_t parameterMask)
+        {
+            readbackMask.fetch_or(parameterMask, std::memory_order_release);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Wakes the sender thread, for anything left by repost() or
+            postReadback(), which don't. */
+        void flush()
+        {
+            sender.wake(*this);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Forgets every unsent message: useful when the device goes away. */
+        void discardAll()
+        {
+            for (Slot& slot: slots)
+            {
+                slot.pending.store(false);
+            }
+            readbackMask.store(0);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr size_t NumWords = MaxMessageBytes / 4;
+        static constexpr size_t NumSlots = static_cast<size_t>(Command::NumCommands);
+
+        struct Slot
+        {
+            std::atomic<uint32_t> sequence;
+            std::atomic<bool> pending;
+            std::atomic<uint8_t> numBytes;
+            std::atomic<uint32_t> stamp;    // when it was last posted: the sending order
+            std::atomic<uint32_t> words[NumWords];
+        };
+
+        struct Outgoing
+        {
+            uint32_t stamp;
+            size_t numBytes;
+            uint8_t message[MaxMessageBytes];
+        };
+
+        MidiDuplex& duplex;
+        const Tracker& tracker;
+        std::unique_ptr<WorkerThread> ownSender; // only if none is shared
+        WorkerThread& sender;
+        Slot slots[NumSlots];
+        std::atomic<uint32_t> readbackMask;
+        std::atomic<uint32_t> nextStamp;
+
+        // ------------------------------------------------------------------------
+
+        /** On the sender thread, after post() or flush(). */
+        void runJob() override
+        {
+            sendPending();
+        }
+
+        // ------------------------------------------------------------------------
+
+        void sendPending()
+        {
+            Outgoing outgoing[NumSlots];
+            size_t count = 0;
+            for (Slot& slot: slots)
+            {
+                if (take(slot, outgoing[count]))
+                {
+                    ++count;
+                }
+            }
+            // in posting order; stamps are compared by difference, as they wrap
+            std::sort(outgoing, outgoing + count, [](const Outgoing& a, const Outgoing& b)
+            {
+                return static_cast<int32_t>(a.stamp - b.stamp) < 0;
+            });
+            for (size_t i = 0; i < count; ++i)
+            {
+                duplex.sendMessage(juce::MidiMessage(outgoing[i].message, static_cast<int>(outgoing[i].numBytes)));
+            }
+
+            const uint32_t readbacks = readbackMask.exchange(0, std::memory_order_acquire);
+            if (readbacks != 0)
+            {
+                uint8_t message[MaxMessageBytes];
+                const size_t numBytes = tracker.readbackMessage(message, readbacks);
+                duplex.sendMessage(juce::MidiMessage(message, static_cast<int>(numBytes)));
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool take(Slot& slot, Outgoing& o)
+        {
+            if (!slot.pending.exchange(false, std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            uint32_t before, after;
+            do
+            {
+                before = slot.sequence.load(std::memory_order_acquire);
+                o.numBytes = slot.numBytes.load(std::memory_order_relaxed);
+                o.stamp = slot.stamp.load(std::memory_order_relaxed);
+                for (size_t i = 0; i < MaxMessageBytes; ++i)
+                {
+                    o.message[i] = static_cast<uint8_t>(slot.words[i / 4].load(std::memory_order_relaxed) >> (8 * (i % 4)));
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = slot.sequence.load(std::memory_order_relaxed);
+            } while ((before != after) || (before & 1));
+            return true;
+        }
+    };
+};
@@ -0,0 +1,307 @@
+/*
+ * MIDI drivers
+ * Process-wide cache of the MIDI device lists
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+// juce::MidiDeviceListConnection first shipped in JUCE 7.0.3; define this as 0
+// or 1 before including to override the version check.
+#ifndef MIDI_DEVICE_HOTPLUG
+ #if (JUCE_MAJOR_VERSION > 7) || (JUCE_MAJOR_VERSION == 7 && (JUCE_MINOR_VERSION > 0 || JUCE_BUILDNUMBER >= 3))
+  #define MIDI_DEVICE_HOTPLUG 1
+ #else
+  #define MIDI_DEVICE_HOTPLUG 0
+ #endif
+#endif
+
+namespace Midi
+{
+    /** One copy of the MIDI input and output device lists for the whole process,
+        so that any number of MidiDuplex objects can look for their devices
+        without each of them enumerating the system. Share it with
+        juce::SharedResourcePointer<DeviceCache>, and create it on the message
+        thread.
+
+        Where JUCE can report hot-plugging (JUCE 7.0.3 onwards), the lists are
+        refreshed when the system says they have changed, and otherwise only
+        occasionally as a safety net. Elsewhere they are polled, backing off
+        while nothing changes. Each refresh is compared with the last one, and
+        listeners hear only about real changes. Lookups may be made from any
+        thread. */
+    class DeviceCache : private juce::Timer
+    {
+    public:
+        class Listener
+        {
+        public:
+            virtual ~Listener() {}
+
+            /** Called on the message thread when devices have appeared or gone away. */
+            virtual void midiDevicesChanged() = 0;
+        };
+
+        // ------------------------------------------------------------------------
+
+        DeviceCache() :
+            generation(0),
+            intervalMilliseconds(MinimumIntervalMilliseconds),
+            longestIntervalMilliseconds(MaximumIntervalMilliseconds),
+            defaultLongestIntervalMilliseconds(MaximumIntervalMilliseconds)
+        {
+            refresh();
+           #if MIDI_DEVICE_HOTPLUG
+            hotplug = juce::MidiDeviceListConnection::make([this]() { refreshNow(); });
+            intervalMilliseconds = longestIntervalMilliseconds = defaultLongestIntervalMilliseconds = HotplugIntervalMilliseconds;
+           #endif
+            startTimer(intervalMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void addListener(Listener* listener)    { listeners.add(listener); }
+        void removeListener(Listener* listener) { listeners.remove(listener); }
+
+        // ------------------------------------------------------------------------
+
+        /** Returns the identifier of the first output whose name starts with
+            namePrefix, or an empty string if there is none. */
+        juce::String findOutput(const juce::String& namePrefix) const
+        {
+            const juce::ScopedLock sl(lock);
+            return find(outputs, namePrefix);
+        }
+
+        /** Returns the identifier of the first input whose name starts with
+            namePrefix, or an empty string if there is none. */
+        juce::String findInput(const juce::String& namePrefix) const
+        {
+            const juce::ScopedLock sl(lock);
+            return find(inputs, namePrefix);
+        }
+
+        /** Returns every output whose name starts with namePrefix, in the
+            system's order. */
+        juce::Array<juce::MidiDeviceInfo> findAllOutputs(const juce::String& namePrefix) const
+        {
+            const juce::ScopedLock sl(lock);
+            return findAll(outputs, namePrefix);
+        }
+
+        /** Returns every input whose name starts with namePrefix, in the
+            system's order. */
+        juce::Array<juce::MidiDeviceInfo> findAllInputs(const juce::String& namePrefix) const
+        {
+            const juce::ScopedLock sl(lock);
+            return findAll(inputs, namePrefix);
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool hasOutput(const juce::String& identifier) const
+        {
+            const juce::ScopedLock sl(lock);
+            return outputs.has(identifier);
+        }
+
+        bool hasInput(const juce::String& identifier) const
+        {
+            const juce::ScopedLock sl(lock);
+            return inputs.has(identifier);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Goes up by one each time the device lists change. */
+        uint32_t getGeneration() const
+        {
+            return generation.load();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Makes sure the lists are polled at least this often while nothing
+            changes, for as long as client wants it: the fastest request from any
+            client applies. Used by clients that want to see new devices quickly;
+            it doesn't matter when hot-plug notifications are available. Call on
+            the message thread. */
+        void requestPollInterval(const void* client, const int milliseconds)
+        {
+            pollRequests[client] = milliseconds;
+            updatePollInterval();
+        }
+
+        /** Withdraws client's request, if it made one. Clients must do this
+            before they are destroyed. */
+        void releasePollInterval(const void* client)
+        {
+            if (pollRequests.erase(client) > 0)
+            {
+                updatePollInterval();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Enumerates the devices straight away rather than waiting for the timer.
+            Call on the message thread. */
+        void refreshNow()
+        {
+            timerCallback();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int MinimumIntervalMilliseconds = 50;
+        static constexpr int MaximumIntervalMilliseconds = 1000;
+        static constexpr int HotplugIntervalMilliseconds = 5000;
+
+        /** The device list, with its entries sorted by name so that the ones
+            starting with a given prefix are next to one another, and a sorted
+            list of identifiers. */
+        struct Index
+        {
+            struct Entry
+            {
+                juce::String name, identifier;
+                int ordinal; // position in the system's own list
+            };
+
+            juce::Array<juce::MidiDeviceInfo> devices;
+            std::vector<Entry> byName;
+            std::vector<juce::String> identifiers;
+
+            void build(const juce::Array<juce::MidiDeviceInfo>& newDevices)
+            {
+                devices = newDevices;
+                byName.clear();
+                byName.reserve(static_cast<size_t>(devices.size()));
+                for (int i = 0; i < devices.size(); ++i)
+                {
+                    byName.push_back({ devices[i].name, devices[i].identifier, i });
+                }
+                std::sort(byName.begin(), byName.end(),
+                          [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+                identifiers.clear();
+                for (const Entry& e: byName)
+                {
+                    identifiers.push_back(e.identifier);
+                }
+                std::sort(identifiers.begin(), identifiers.end());
+            }
+
+            bool has(const juce::String& identifier) const
+            {
+                return std::binary_search(identifiers.begin(), identifiers.end(), identifier);
+            }
+        };
+
+        juce::CriticalSection lock;
+        Index outputs, inputs;
+        std::atomic<uint32_t> generation;
+        int intervalMilliseconds, longestIntervalMilliseconds, defaultLongestIntervalMilliseconds;
+        std::map<const void*, int> pollRequests;
+        juce::ListenerList<Listener> listeners;
+       #if MIDI_DEVICE_HOTPLUG
+        juce::MidiDeviceListConnection hotplug;
+       #endif
+
+        // ------------------------------------------------------------------------
+
+        void timerCallback() override
+        {
+            const bool changed = refresh();
+            // poll quickly after a change (more may follow), then back off
+            intervalMilliseconds = changed ? MinimumIntervalMilliseconds
+                                           : juce::jmin(intervalMilliseconds * 2, longestIntervalMilliseconds);
+            startTimer(intervalMilliseconds);
+            if (changed)
+            {
+                listeners.call([](Listener& l) { l.midiDevicesChanged(); });
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void updatePollInterval()
+        {
+            longestIntervalMilliseconds = defaultLongestIntervalMilliseconds;
+            for (const auto& r: pollRequests)
+            {
+                longestIntervalMilliseconds = juce::jmin(longestIntervalMilliseconds, r.second);
+            }
+            longestIntervalMilliseconds = juce::jmax(MinimumIntervalMilliseconds, longestIntervalMilliseconds);
+            // a shorter limit applies now; a longer one as the timer backs off
+            if (intervalMilliseconds > longestIntervalMilliseconds)
+            {
+                intervalMilliseconds = longestIntervalMilliseconds;
+                startTimer(intervalMilliseconds);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Enumerates the devices, and returns true if they differ from last time. */
+        bool refresh()
+        {
+            // enumerate outside the lock: this is the slow part
+            const juce::Array<juce::MidiDeviceInfo> newOutputs = juce::MidiOutput::getAvailableDevices();
+            const juce::Array<juce::MidiDeviceInfo> newInputs = juce::MidiInput::getAvailableDevices();
+
+            const juce::ScopedLock sl(lock);
+            if ((newOutputs == outputs.devices) && (newInputs == inputs.devices))
+            {
+                return false;
+            }
+            outputs.build(newOutputs);
+            inputs.build(newInputs);
+            ++generation;
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Of the devices whose names start with namePrefix, returns the one that
+            the system lists first, as a linear search of its list would. */
+        static juce::String find(const Index& index, const juce::String& namePrefix)
+        {
+            auto it = std::lower_bound(index.byName.begin(), index.byName.end(), namePrefix,
+                                       [](const Index::Entry& e, const juce::String& prefix) { return e.name < prefix; });
+            const Index::Entry* best = nullptr;
+            for (; (it != index.byName.end()) && it->name.startsWith(namePrefix); ++it)
+            {
+                if (!best || (it->ordinal < best->ordinal))
+                {
+                    best = &*it;
+                }
+            }
+            return best ? best->identifier : juce::String();
+        }
+
+        // ------------------------------------------------------------------------
+
+        static juce::Array<juce::MidiDeviceInfo> findAll(const Index& index, const juce::String& namePrefix)
+        {
+            auto it = std::lower_bound(index.byName.begin(), index.byName.end(), namePrefix,
+                                       [](const Index::Entry& e, const juce::String& prefix) { return e.name < prefix; });
+            std::vector<int> ordinals;
+            for (; (it != index.byName.end()) && it->name.startsWith(namePrefix); ++it)
+            {
+                ordinals.push_back(it->ordinal);
+            }
+            std::sort(ordinals.begin(), ordinals.end());
+
+            juce::Array<juce::MidiDeviceInfo> result;
+            for (int i: ordinals)
+            {
+                result.add(index.devices[i]);
+            }
+            return result;
+        }
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceCache)
+    };
+};
@@ -0,0 +1,413 @@
+/*
+ * MIDI drivers
+ * Hot-standby failover between two head trackers
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Combines a primary and a backup tracker, worn together, into one stream
+        of orientation. The active tracker's frames are passed on. A watchdog
+        thread wakes when the active tracker's next frame is due; if it still
+        hasn't arrived a few jitters later (see getDeadline()) and the other is
+        still sending, the controller switches straight away, and the other
+        tracker's next frame is the first to be passed on. So the output stands
+        still for at most one frame period of each tracker plus that margin;
+        Metrics reports how long it actually was. A tracker that disconnects is
+        lost straight away, and one whose rate isn't known yet (because it has
+        never sent a frame, say) once it has been silent for SilenceMilliseconds.
+
+        The two trackers won't agree exactly on which way is forward, so while
+        both are running, the controller keeps track of the rotation between
+        them, comparing the two at the same moment: the standby's orientation
+        is interpolated to the time of the active tracker's latest frame. After
+        a switch, this offset is applied to the new tracker's data so that the
+        orientation carries on from where it was rather than jumping. If the
+        original tracker comes back, it becomes the standby.
+
+        Both drivers must be turned on, and should outlive the controller.
+        Listeners are called on the MIDI thread of whichever tracker is active. */
+    class FailoverController : private juce::Thread
+    {
+    public:
+        enum class Source { Primary, Backup };
+
+        class Listener
+        {
+        public:
+            virtual ~Listener() {}
+
+            /** The combined orientation as a row-major rotation matrix (see HeadMatrix). */
+            virtual void failoverOrientation(const float* /*matrix*/) {}
+
+            /** Called after a switch, just before the first frame from the new source. */
+            virtual void failoverSwitched(Source /*newSource*/) {}
+        };
+
+        /** How the last switch went. */
+        struct Metrics
+        {
+            int numberOfSwitches = 0;
+
+            /** From the time the lost tracker's next frame was due (or it
+                disconnected), to the switch. */
+            double lastDetectionMilliseconds = 0.0;
+
+            /** From the lost tracker's last frame to the new tracker's first
+                frame after the switch: how long the output stood still. Zero if
+                the lost tracker never sent a frame. */
+            double lastGapMilliseconds = 0.0;
+
+            /** The jump in orientation at the last switch, and the largest so far. */
+            float lastGlitchRadian = 0.0f;
+            float largestGlitchRadian = 0.0f;
+        };
+
+        // ------------------------------------------------------------------------
+
+        FailoverController(TrackerDriver& primaryDriver, TrackerDriver& backupDriver) :
+            juce::Thread("Failover watchdog"),
+            primary(*this, Source::Primary, primaryDriver),
+            backup(*this, Source::Backup, backupDriver),
+            active(Source::Primary),
+            outputTime(0.0),
+            switchedFrom(-1.0)
+        {
+            eye(output);
+            primary.driver.addListener(&primary, Dispatch::Realtime);
+            backup.driver.addListener(&backup, Dispatch::Realtime);
+            startThread();
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~FailoverController()
+        {
+            signalThreadShouldExit();
+            notify();
+            stopThread(StopMilliseconds);
+            primary.driver.removeListener(&primary);
+            backup.driver.removeListener(&backup);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void addListener(Listener* listener)    { listeners.add(listener, Dispatch::Realtime); }
+        void removeListener(Listener* listener) { listeners.remove(listener); }
+
+        // ------------------------------------------------------------------------
+
+        Source getActiveSource() const
+        {
+            const juce::SpinLock::ScopedLockType sl(lock);
+            return active;
+        }
+
+        /** Copies the latest combined orientation (nine floats, row-major). */
+        void getMatrix(float* destination) const
+        {
+            const juce::SpinLock::ScopedLockType sl(lock);
+            std::copy(output, output + 9, destination);
+        }
+
+        Metrics getMetrics() const
+        {
+            const juce::SpinLock::ScopedLockType sl(lock);
+            return metrics;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr double JitterMargin = 4.0; // average deviations past the due time
+        static constexpr double MinimumMarginMilliseconds = 2.0;
+        static constexpr double SilenceMilliseconds = 600.0; // as MidiDuplex's watchdog, before the rate is known
+        static constexpr int IdleMilliseconds = 100; // watchdog, when there's nothing to switch to
+        static constexpr int StopMilliseconds = 2000;
+
+        /** One of the two trackers. Its offset takes its own orientation to the
+            combined orientation. */
+        struct Input : public TrackerDriver::Listener
+        {
+            Input(FailoverController& owner, const Source inputSource, TrackerDriver& inputDriver) :
+                controller(owner), source(inputSource), driver(inputDriver),
+                disconnected(false), waitingSince(juce::Time::getMillisecondCounterHiRes()),
+                previousTime(0.0), latestTime(0.0), hasFrame(false)
+            {
+                eye(offset);
+                eye(previous);
+                eye(latest);
+            }
+
+            void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+            {
+                head.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+                controller.frameArrived(*this);
+            }
+            void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+            {
+                head.setOrientationQuaternion(qw, qx, qy, qz);
+                controller.frameArrived(*this);
+            }
+            void trackerOrientationM(float* matrix) override
+            {
+                head.setOrientationMatrix(matrix);
+                controller.frameArrived(*this);
+            }
+            /** On the message thread. */
+            void trackerMidiConnectionChanged(Midi::State state) override
+            {
+                // the rate may differ when it reconnects; reset() leaves the
+                // clearing to this tracker's MIDI thread
+                arrivals.reset();
+                waitingSince.store(juce::Time::getMillisecondCounterHiRes());
+                disconnected.store(state != Midi::State::Connected, std::memory_order_release);
+                controller.notify(); // a disconnected active tracker is lost now
+            }
+
+            FailoverController& controller;
+            Source source;
+            TrackerDriver& driver;
+            HeadMatrix head;           // written only by this tracker's MIDI thread
+            ArrivalStatistics arrivals;
+            std::atomic<bool> disconnected;
+            std::atomic<double> waitingSince; // since (dis)connection, for a source with no known rate
+            float offset[9];           // these are guarded by the controller's lock
+            float previous[9], latest[9];
+            double previousTime, latestTime;
+            bool hasFrame;
+
+            /** True if a frame is overdue, judged at the given time. */
+            bool isLost(const double now) const
+            {
+                return now > getDeadline();
+            }
+
+            /** The time after which this tracker counts as lost: the next
+                frame's due time, plus a margin for its usual jitter. */
+            double getDeadline() const
+            {
+                if (disconnected.load(std::memory_order_acquire))
+                {
+                    return waitingSince.load();
+                }
+                const double interval = arrivals.getInterval();
+                const double last = arrivals.getLastArrival();
+                if ((interval > 0.0) && (last > 0.0))
+                {
+                    return last + interval + std::max(MinimumMarginMilliseconds, JitterMargin * arrivals.getJitter());
+                }
+                return std::max(last, waitingSince.load()) + SilenceMilliseconds;
+            }
+
+            /** When the frame that didn't arrive was due. */
+            double getDueTime() const
+            {
+                const double since = waitingSince.load();
+                if (disconnected.load(std::memory_order_acquire))
+                {
+                    return since;
+                }
+                const double interval = arrivals.getInterval();
+                const double last = arrivals.getLastArrival();
+                if ((interval > 0.0) && (last > 0.0))
+                {
+                    return last + interval;
+                }
+                return std::max(last, since) + SilenceMilliseconds;
+            }
+        };
+
+        Input primary, backup;
+        ListenerList<Listener> listeners;
+        mutable juce::SpinLock lock;
+        Source active;
+        float output[9];
+        double outputTime; // when the frame behind output arrived
+        double switchedFrom; // the lost tracker's last frame, until the new one's first; else negative
+        Metrics metrics;
+
+        // ------------------------------------------------------------------------
+
+        /** Called on the input's MIDI thread, after its HeadMatrix has been set. */
+        void frameArrived(Input& input)
+        {
+            const double now = juce::Time::getMillisecondCounterHiRes();
+            input.arrivals.noteArrival(now);
+            Input& other = (&input == &primary) ? backup : primary;
+
+            float combined[9];
+            bool isActive, switched = false, announce = false;
+            {
+                const juce::SpinLock::ScopedLockType sl(lock);
+                std::copy(input.latest, input.latest + 9, input.previous);
+                input.previousTime = input.latestTime;
+                input.head.getMatrix(input.latest);
+                input.latestTime = now;
+                const bool hadFrame = input.hasFrame;
+                input.hasFrame = true;
+
+                if ((active != input.source) && other.isLost(now))
+                {
+                    // the watchdog hasn't got to it yet
+                    switchTo(input, other, now);
+                    switched = true;
+                }
+
+                isActive = (active == input.source);
+                if (isActive)
+                {
+                    if (switchedFrom >= 0.0)
+                    {
+                        // the first frame since a switch, by this thread or the watchdog
+                        announce = true;
+                        metrics.lastGapMilliseconds = (switchedFrom > 0.0) ? (now - switchedFrom) : 0.0;
+                        switchedFrom = -1.0;
+                    }
+                    multiply(input.offset, input.latest, output);
+                    outputTime = now;
+                    std::copy(output, output + 9, combined);
+                }
+                else if (hadFrame && other.hasFrame && !other.isLost(now) && (outputTime >= input.previousTime))
+                {
+                    // standby: keep its offset up to date while both are live, so
+                    // that offset * latest matches the combined orientation. The
+                    // two were sampled at different times, so compare the combined
+                    // orientation with this tracker's as it was at outputTime
+                    const double span = input.latestTime - input.previousTime;
+                    const float fraction = (span > 0.0) ? static_cast<float>((outputTime - input.previousTime) / span) : 1.0f;
+                    float paired[9], transposed[9];
+                    interpolate(input.previous, input.latest, fraction, paired);
+                    transpose(paired, transposed);
+                    multiply(output, transposed, input.offset);
+                }
+            }
+
+            if (switched)
+            {
+                // the watchdog was waiting on the other tracker's deadline
+                notify();
+            }
+            if (announce)
+            {
+                const Source newSource = input.source;
+                listeners.callRealtime([newSource](Listener* l) { l->failoverSwitched(newSource); });
+            }
+            if (isActive)
+            {
+                listeners.callRealtime([&combined](Listener* l) { l->failoverOrientation(combined); });
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Under the lock. The active tracker has gone quiet: make input active,
+            carrying on from the last combined orientation by way of its offset.
+            Its next frame is the first to be passed on, announced by frameArrived(). */
+        void switchTo(Input& input, Input& lost, const double now)
+        {
+            active = input.source;
+            float next[9];
+            multiply(input.offset, input.latest, next);
+            ++metrics.numberOfSwitches;
+            metrics.lastDetectionMilliseconds = now - lost.getDueTime();
+            metrics.lastGlitchRadian = lost.hasFrame ? angleBetween(output, next) : 0.0f;
+            metrics.largestGlitchRadian = std::max(metrics.largestGlitchRadian, metrics.lastGlitchRadian);
+            switchedFrom = lost.hasFrame ? lost.latestTime : 0.0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The watchdog: sleeps until the active tracker's deadline, and switches
+            as soon as it passes, rather than when the standby's next frame
+            happens to notice. */
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                const double now = juce::Time::getMillisecondCounterHiRes();
+                double deadline;
+                {
+                    const juce::SpinLock::ScopedLockType sl(lock);
+                    Input& current = (active == Source::Primary) ? primary : backup;
+                    Input& other = (active == Source::Primary) ? backup : primary;
+                    if (current.isLost(now) && other.hasFrame && !other.isLost(now))
+                    {
+                        switchTo(other, current, now);
+                    }
+                    deadline = (active == Source::Primary) ? primary.getDeadline() : backup.getDeadline();
+                }
+                // a deadline that has passed leaves nothing to switch to yet:
+                // frameArrived() switches if the standby comes back first
+                wait((deadline > now) ? static_cast<int>(std::ceil(deadline - now)) : IdleMilliseconds);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        static void eye(float* m)
+        {
+            for (int i = 0; i < 9; ++i)
+            {
+                m[i] = (i & 3) ? 0.f : 1.f;
+            }
+        }
+
+        static void transpose(const float* m, float* result)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    result[3 * r + c] = m[3 * c + r];
+                }
+            }
+        }
+
+        static void multiply(const float* a, const float* b, float* result)
+        {
+            for (int r = 0; r < 3; ++r)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    result[3 * r + c] = a[3 * r] * b[c] + a[3 * r + 1] * b[3 + c] + a[3 * r + 2] * b[6 + c];
+                }
+            }
+        }
+
+        /** The rotation a fraction of the way from a to b. Normalised linear
+            interpolation of quaternions: as good as slerp over the few degrees
+            between consecutive frames. */
+        static void interpolate(const float* a, const float* b, const float fraction, float* result)
+        {
+            HeadMatrix h;
+            float aw, ax, ay, az, bw, bx, by, bz;
+            h.setOrientationMatrix(a);
+            h.getQuaternion(aw, ax, ay, az);
+            h.setOrientationMatrix(b);
+            h.getQuaternion(bw, bx, by, bz);
+            // q and -q are the same rotation: take the shorter way round
+            const float sign = ((aw * bw + ax * bx + ay * by + az * bz) < 0.0f) ? -1.0f : 1.0f;
+            const float w = aw + fraction * (sign * bw - aw);
+            const float x = ax + fraction * (sign * bx - ax);
+            const float y = ay + fraction * (sign * by - ay);
+            const float z = az + fraction * (sign * bz - az);
+            const float norm = sqrtf(w * w + x * x + y * y + z * z);
+            h.setOrientationQuaternion(w / norm, x / norm, y / norm, z / norm);
+            h.getMatrix(result);
+        }
+
+        /** The angle of the rotation that takes a to b: from the trace of a * bT. */
+        static float angleBetween(const float* a, const float* b)
+        {
+            float trace = 0.0f;
+            for (int i = 0; i < 9; ++i)
+            {
+                trace += a[i] * b[i];
+            }
+            return acosf(std::max(-1.0f, std::min(1.0f, (trace - 1.0f) * 0.5f)));
+        }
+    };
+};
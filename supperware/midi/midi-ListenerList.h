@@ -0,0 +1,246 @@
+/*
+ * MIDI drivers
+ * Copy-on-write listener registry that can be read from the MIDI thread
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Where a listener wants its callbacks. Realtime listeners are called
+        inline on the thread that received the data, and must be quick.
+        MessageThread listeners are called asynchronously on the message
+        thread, and see only the latest data if several frames arrive before
+        they are called. */
+    enum class Dispatch { Realtime, MessageThread };
+
+    /** A list of listeners that may be added to and removed from on any
+        non-realtime thread while it is being called on the MIDI thread.
+        Each change builds a new copy of the list and publishes it atomically,
+        so callRealtime() never locks, allocates, or sees a half-built list.
+        Once remove() returns, the listener will not be called again, so it is
+        safe to delete it. A realtime listener must not add or remove listeners
+        from inside its own callback.
+
+        Readers announce themselves against an epoch rather than the list, so
+        a writer only waits for readers that might still hold the list it has
+        just replaced: never for ones that arrive afterwards. */
+    template <class ListenerClass>
+    class ListenerList
+    {
+    public:
+        ListenerList() :
+            snapshot(new Snapshot()),
+            epoch(0),
+            callingOnMessageThread(nullptr)
+        {
+            readers[0].store(0);
+            readers[1].store(0);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~ListenerList()
+        {
+            delete snapshot.load();
+        }
+
+        // ------------------------------------------------------------------------
+
+        void add(ListenerClass* listener, const Dispatch dispatch)
+        {
+            const juce::ScopedLock sl(writeLock);
+            const Snapshot* current = snapshot.load();
+            if (current->find(listener) < 0)
+            {
+                Snapshot* next = new Snapshot(*current);
+                next->entries.push_back({ listener, dispatch });
+                publish(next);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Waits only if the listener is being called on the message thread
+            right now (and this is another thread), until that call returns. */
+        void remove(ListenerClass* listener)
+        {
+            {
+                const juce::ScopedLock sl(writeLock);
+                const Snapshot* current = snapshot.load();
+                const int index = current->find(listener);
+                if (index < 0)
+                {
+                    return;
+                }
+                Snapshot* next = new Snapshot(*current);
+                next->entries.erase(next->entries.begin() + index);
+                publish(next);
+            }
+
+            // a listener removing itself from its own callback is fine as it is
+            if (!juce::MessageManager::existsAndIsCurrentThread())
+            {
+                while (callingOnMessageThread.load() == listener)
+                {
+                    juce::Thread::yield();
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** True if any listener has asked for the given dispatch. */
+        bool has(const Dispatch dispatch) const
+        {
+            int parity;
+            const Snapshot* current = acquire(parity);
+            const bool result = (current->count(dispatch) > 0);
+            release(parity);
+            return result;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Calls function(listener) for each realtime listener. Never blocks. */
+        template <typename Function>
+        void callRealtime(Function&& function) const
+        {
+            int parity;
+            const Snapshot* current = acquire(parity);
+            for (const Entry& e: current->entries)
+            {
+                if (e.dispatch == Dispatch::Realtime)
+                {
+                    function(e.listener);
+                }
+            }
+            release(parity);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Calls function(listener) for each message-thread listener. Listeners
+            may add or remove listeners (including themselves) from the callback.
+            No lock is held while they are called, so other threads can change
+            the list meanwhile. */
+        template <typename Function>
+        void callMessageThread(Function&& function) const
+        {
+            std::vector<Entry> entries;
+            {
+                const juce::ScopedLock sl(writeLock);
+                entries = snapshot.load()->entries;
+            }
+            for (const Entry& e: entries)
+            {
+                if (e.dispatch != Dispatch::MessageThread)
+                {
+                    continue;
+                }
+                // announce the call before checking that the listener is still
+                // there: remove() publishes first and then looks, so one of us
+                // always sees the other
+                callingOnMessageThread.store(e.listener);
+                if (contains(e.listener))
+                {
+                    function(e.listener);
+                }
+                callingOnMessageThread.store(nullptr);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        struct Entry
+        {
+            ListenerClass* listener;
+            Dispatch dispatch;
+        };
+
+        struct Snapshot
+        {
+            std::vector<Entry> entries;
+
+            int find(const ListenerClass* listener) const
+            {
+                for (size_t i = 0; i < entries.size(); ++i)
+                {
+                    if (entries[i].listener == listener) return static_cast<int>(i);
+                }
+                return -1;
+            }
+
+            int count(const Dispatch dispatch) const
+            {
+                int n = 0;
+                for (const Entry& e: entries)
+                {
+                    if (e.dispatch == dispatch) ++n;
+                }
+                return n;
+            }
+        };
+
+        std::atomic<Snapshot*> snapshot;
+        std::atomic<uint32_t> epoch;
+        mutable std::atomic<int> readers[2];    // by the parity of the epoch they arrived in
+        mutable std::atomic<ListenerClass*> callingOnMessageThread;
+        juce::CriticalSection writeLock;
+
+        // ------------------------------------------------------------------------
+
+        /** Everything here is sequentially consistent: a reader either registers
+            in the epoch that the writer then waits for, or sees the writer's new
+            epoch, and so its new snapshot. */
+        const Snapshot* acquire(int& parity) const
+        {
+            for (;;)
+            {
+                const uint32_t e = epoch.load();
+                parity = static_cast<int>(e & 1);
+                readers[parity].fetch_add(1);
+                if (epoch.load() == e)
+                {
+                    return snapshot.load();
+                }
+                readers[parity].fetch_sub(1); // a writer has just moved on: try again
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void release(const int parity) const
+        {
+            readers[parity].fetch_sub(1);
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool contains(const ListenerClass* listener) const
+        {
+            int parity;
+            const bool result = (acquire(parity)->find(listener) >= 0);
+            release(parity);
+            return result;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** With writeLock held. */
+        void publish(Snapshot* next)
+        {
+            Snapshot* previous = snapshot.exchange(next);
+            const int parity = static_cast<int>(epoch.fetch_add(1) & 1);
+            // wait for readers from before the change, which might still be
+            // walking the old list: they only hold it for one callback
+            while (readers[parity].load() != 0)
+            {
+                juce::Thread::yield();
+            }
+            delete previous;
+        }
+    };
+};
@@ -0,0 +1,99 @@
+/*
+ * MIDI drivers
+ * Single-writer mailbox for handing the latest frame of data between threads
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Holds the most recent set of Size floats written by one thread, so that
+        another thread can collect it later. Neither side ever waits: the writer
+        just overwrites, and a reader that catches a write in progress tries again.
+        Intermediate values are deliberately lost; only the latest one matters. */
+    template <size_t Size>
+    class Mailbox
+    {
+    public:
+        Mailbox() :
+            sequence(0),
+            collected(0)
+        {
+            for (std::atomic<float>& v : values)
+            {
+                v.store(0.0f, std::memory_order_relaxed);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Publishes a new set of values. Call from one thread only. */
+        void post(const float* newValues)
+        {
+            const uint32_t s = sequence.load(std::memory_order_relaxed);
+            sequence.store(s + 1, std::memory_order_relaxed); // odd: write in progress
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < Size; ++i)
+            {
+                values[i].store(newValues[i], std::memory_order_relaxed);
+            }
+            sequence.store(s + 2, std::memory_order_release);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Copies the latest values into destination. Returns false, without
+            copying, if nothing has been posted since the last collect(). */
+        bool collect(float* destination)
+        {
+            uint32_t s;
+            if (!read(destination, true, s))
+            {
+                return false;
+            }
+            collected.store(s, std::memory_order_relaxed);
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Copies the latest values into destination regardless of whether they
+            have been seen before. Returns the number of posts so far. */
+        uint32_t peek(float* destination) const
+        {
+            uint32_t s;
+            read(destination, false, s);
+            return s / 2;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> collected;
+        std::atomic<float> values[Size];
+
+        // ------------------------------------------------------------------------
+
+        bool read(float* destination, const bool skipIfCollected, uint32_t& s) const
+        {
+            uint32_t after;
+            do
+            {
+                s = sequence.load(std::memory_order_acquire);
+                if (skipIfCollected && (s == collected.load(std::memory_order_relaxed)))
+                {
+                    return false;
+                }
+                for (size_t i = 0; i < Size; ++i)
+                {
+                    destination[i] = values[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = sequence.load(std::memory_order_relaxed);
+            } while ((s != after) || (s & 1));
+            return true;
+        }
+    };
+};
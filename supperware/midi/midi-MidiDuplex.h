@@ -12,30 +12,52 @@ namespace Midi
     enum class State { Unavailable, Available, Bootloader, Connected };
     enum class Connection { AsBootloader, AsDevice, AsEither };
 
-    class MidiDuplex : public juce::MidiInputCallback, protected juce::MultiTimer
+    class MidiDuplex : public juce::MidiInputCallback, protected juce::MultiTimer, private DeviceCache::Listener
     {
     public:
-        MidiDuplex(const juce::String deviceName, const juce::String bootloaderName) :
+        /** Ports are opened and closed on sharedDeviceThread if one is given, and
+            otherwise on a thread of this object's own. */
+        MidiDuplex(const juce::String deviceName, const juce::String bootloaderName, WorkerThread* sharedDeviceThread = nullptr) :
             midiOut(nullptr),
             midiIn(nullptr),
             device(deviceName),
             bootloader(bootloaderName),
             connectionState(State::Unavailable),
             autoReconnect(false),
-            autoDisconnect(true)
+            autoDisconnect(true),
+            pollMilliseconds(TimeoutMilliseconds),
+            deviceWasAvailable(false),
+            deviceAppearedTime(0.0),
+            missedFramesForDisconnect(DefaultMissedFrames),
+            lastTraffic(0.0),
+            externallyServiced(false),
+            pendingRequest(NoRequest),
+            working(false),
+            stateChanges(0),
+            stateChangesDelivered(0),
+            ownDeviceThread(sharedDeviceThread ? nullptr : new WorkerThread("MIDI device open/close")),
+            deviceThread(sharedDeviceThread ? *sharedDeviceThread : *ownDeviceThread),
+            deviceJob(*this),
+            stateNotifier(*this),
+            processor(*this)
         {
+            deviceThread.add(&deviceJob);
+            devices->addListener(this);
             /* This timer doesn't ever stop: it handles unavailable/available signalling
                even when automatic modes are switched off.
                MultiTimer is used here because it's often necessary to use other timers
                in inherited classes. */
-            startTimer(0, TimeoutMilliseconds);
+            scheduleService(TimeoutMilliseconds);
         }
 
         // ------------------------------------------------------------------------
 
         ~MidiDuplex()
         {
-            disconnect();
+            devices->releasePollInterval(this);
+            devices->removeListener(this);
+            stateNotifier.cancelPendingUpdate();
+            shutDownDevices();
         }
 
         // ------------------------------------------------------------------------
@@ -60,7 +82,7 @@ namespace Midi
 
         State getConnectionState() const
         {
-            return connectionState;
+            return connectionState.load();
         }
 
         // ------------------------------------------------------------------------
@@ -68,8 +90,18 @@ namespace Midi
         /** Simplified version of getConnectionState(). */
         bool isConnected() const
         {
-            return (connectionState == State::Connected) ||
-                   (connectionState == State::Bootloader);
+            const State state = connectionState.load();
+            return (state == State::Connected) ||
+                   (state == State::Bootloader);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** True from a call to connectAsync() or disconnectAsync() until the
+            device thread has finished with it. */
+        bool isConnecting() const
+        {
+            return (pendingRequest.load() != NoRequest) || working.load();
         }
 
         // ------------------------------------------------------------------------
@@ -80,66 +112,257 @@ namespace Midi
         {
             // reconnects when the connection drops
             autoReconnect = automaticReconnect;
-            startTimer(0, TimeoutMilliseconds);
+            scheduleService(TimeoutMilliseconds);
         }
         
         // ------------------------------------------------------------------------
 
         /** If this is set to true, the device will be marked as disconnected if
-            traffic stops for the length of TimeoutMilliseconds. For this to work,
-            the device would need either active sensing, or a guaranteed frequency
-            of traffic. */
+            traffic stops. While a derived class is reporting a steady stream of
+            frames (see noteStreamFrame), that means missing the number of frames
+            given to setMissedFramesForDisconnect; otherwise it means silence for
+            TimeoutMilliseconds. For this to work, the device would need either
+            active sensing, or a guaranteed frequency of traffic. */
         void setAutoDisconnect(const bool automaticDisconnect)
         {
             // disconnects when inbound traffic stops
             autoDisconnect = automaticDisconnect;
-            startTimer(0, TimeoutMilliseconds);
+            scheduleService(TimeoutMilliseconds);
         }
 
         // ------------------------------------------------------------------------
 
-        bool connect()
+        /** How many frames in a row may go missing from a steady stream before
+            the device is considered lost. */
+        void setMissedFramesForDisconnect(const int numberOfFrames)
         {
-            juce::String outputIdentifier, inputIdentifier;
-            bool connectingToBootloader = false;
-            getIdentifiers(connectingToBootloader, outputIdentifier, inputIdentifier);
-            disconnect();
-            
-            if (outputIdentifier.isNotEmpty() && inputIdentifier.isNotEmpty())
+            missedFramesForDisconnect.store(juce::jmax(1, numberOfFrames));
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The silence, in milliseconds, after which the device will be considered
+            lost: this depends on the measured frame rate. */
+        double getWatchdogTimeout() const
+        {
+            const double interval = stream.getInterval();
+            if (interval <= 0.0)
             {
-                midiOut = juce::MidiOutput::openDevice(outputIdentifier);
-                midiIn  = juce::MidiInput::openDevice(inputIdentifier, this);
-                if (midiOut && midiIn)
+                return TimeoutMilliseconds;
+            }
+            return juce::jlimit(static_cast<double>(MinimumTimeoutMilliseconds), static_cast<double>(TimeoutMilliseconds),
+                                missedFramesForDisconnect.load() * interval);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** How often to look for the device while it is not connected. Shorter
+            intervals notice a hot-plugged device sooner: the process-wide device
+            list is polled at least this often too, until
+            resetAvailabilityPollInterval() is called or this object is destroyed. */
+        void setAvailabilityPollInterval(const int milliseconds)
+        {
+            pollMilliseconds = milliseconds;
+            devices->requestPollInterval(this, milliseconds);
+            if (!isConnected())
+            {
+                scheduleService(pollMilliseconds);
+            }
+        }
+
+        /** Goes back to the default availability polling, and stops asking the
+            device list to be polled any faster than it would be otherwise. */
+        void resetAvailabilityPollInterval()
+        {
+            pollMilliseconds = TimeoutMilliseconds;
+            devices->releasePollInterval(this);
+            if (!isConnected())
+            {
+                scheduleService(pollMilliseconds);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Ties this object to one particular pair of ports, rather than the first
+            ones whose names match. Call before connecting. Pass empty strings to
+            go back to matching by name. */
+        void pinToDevice(const juce::String& outputIdentifier, const juce::String& inputIdentifier)
+        {
+            pinnedOutput = outputIdentifier;
+            pinnedInput = inputIdentifier;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Normally each MidiDuplex runs its own timer to watch its device, and
+            listens for changes to the device lists. When many are in use, their
+            owner may instead stop those timers and call service() on all of them
+            from one timer of its own, every few tens of milliseconds, and also
+            whenever the device lists change. */
+        void setExternallyServiced(const bool shouldBeExternallyServiced)
+        {
+            if (externallyServiced == shouldBeExternallyServiced)
+            {
+                return;
+            }
+            externallyServiced = shouldBeExternallyServiced;
+            if (externallyServiced)
+            {
+                stopTimer(0);
+                devices->removeListener(this);
+            }
+            else
+            {
+                devices->addListener(this);
+                scheduleService(TimeoutMilliseconds);
+            }
+        }
+
+        bool isExternallyServiced() const { return externallyServiced; }
+
+        // ------------------------------------------------------------------------
+
+        /** How promptly the processing thread (see setProcessingThread) picks up
+            input, measured from the MIDI callback to the start of handling. */
+        struct ProcessingMetrics
+        {
+            double averageWakeMilliseconds = 0.0;
+            double worstWakeMilliseconds = 0.0;
+            uint64_t messagesDropped = 0;  // the queue was full
+            uint64_t messagesTooLong = 0;  // longer than RawQueue::MaxMessageBytes
+            bool isRealtime = false;       // real-time scheduling was granted
+        };
+
+        /** By default, input is handled on whichever thread the MIDI backend
+            calls back on, which may be shared with other devices. Enabling this
+            hands each message through a lock-free queue to a thread of the
+            driver's own, so handleSysEx() and handleMidi() (and all the
+            listeners behind them) run there instead. The queue itself is
+            lock-free, but waking the thread signals its event, which takes that
+            event's mutex for an instant.
+
+            Each slot in the queue holds RawQueue::MaxMessageBytes (64), which is
+            plenty for anything the tracker sends. A longer message, from
+            something else sharing the port, is dropped rather than handled out
+            of order on the MIDI thread, and counted in messagesTooLong.
+
+            On Linux, a realtimePriority from 1 to 99 runs the thread as
+            SCHED_FIFO; this needs CAP_SYS_NICE or an rtprio limit, and
+            getProcessingMetrics() reports whether it was granted. Elsewhere the
+            thread runs at normal priority. A non-zero affinityMask pins the
+            thread to those CPUs (not on macOS).
+
+            Call while disconnected: the queue has a single producer, the MIDI
+            callback, which mustn't be running while it is cleared. Returns
+            false, and changes nothing, if the device is connected or a
+            connection or disconnection is under way. */
+        bool setProcessingThread(const bool enabled, const int realtimePriority = 0, const uint32_t affinityMask = 0)
+        {
+            if (isConnected() || isConnecting())
+            {
+                return false;
+            }
+            processor.stop();
+            if (enabled)
+            {
+                processor.start(realtimePriority, affinityMask);
+            }
+            return true;
+        }
+
+        ProcessingMetrics getProcessingMetrics() const
+        {
+            return processor.getMetrics();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Checks the connection: disconnects if traffic has stopped, and looks
+            for the device if it isn't connected. Call on the message thread. */
+        virtual void service()
+        {
+            if (isConnecting())
+            {
+                // the device thread will report back soon
+            }
+            else if (connectionState == State::Connected)
+            {
+                const double timeout = getWatchdogTimeout();
+                const double silence = juce::Time::getMillisecondCounterHiRes() - lastTraffic.load(std::memory_order_relaxed);
+                if (autoDisconnect && (silence > timeout))
                 {
-                    midiIn->start();
-                    setConnectionState(connectingToBootloader ? State::Bootloader : State::Connected);
+                    // data flow has stopped
+                    disconnectAsync();
                 }
                 else
                 {
-                    setConnectionState(State::Unavailable);
+                    // check a few times per timeout, so that loss is noticed promptly
+                    scheduleService(juce::jlimit(MinimumWatchdogPollMilliseconds, TimeoutMilliseconds,
+                                                 static_cast<int>(timeout / 3.0)));
                 }
             }
+            else
+            {
+                checkAvailability();
+            }
 
-            return isConnected();
+            if (!isConnected())
+            {
+                scheduleService(pollMilliseconds);
+            }
         }
 
         // ------------------------------------------------------------------------
 
-        void disconnect()
+        /** (Re)opens the device, and returns true if it is now connected. Waits
+            for the device thread, which can take tens of milliseconds, and
+            calls connectionStateChanged() before returning. On the message
+            thread; connectAsync() doesn't wait. */
+        bool connect()
         {
-            if (midiIn)
+            if (connectAsync())
             {
-                midiIn->stop();
+                waitForDeviceThread();
             }
-            midiIn = nullptr;
-            midiOut = nullptr;
-            setConnectionState(State::Unavailable);
+            return isConnected();
+        }
+
+        /** Asks the device thread to (re)open the device, and returns straight
+            away. The outcome is reported through connectionStateChanged(), on
+            the message thread. Returns true if the request was posted, or
+            false, having done nothing, if the device isn't there. */
+        bool connectAsync()
+        {
+            if (!canConnect())
+            {
+                return false;
+            }
+            post(OpenRequest);
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Closes the device, waiting for the device thread as connect() does. */
+        void disconnect()
+        {
+            disconnectAsync();
+            waitForDeviceThread();
+        }
+
+        /** Asks the device thread to close the device, and returns straight away. */
+        void disconnectAsync()
+        {
+            post(CloseRequest);
         }
 
         // ------------------------------------------------------------------------
 
+        /** May be called from any thread except the audio thread. */
         void sendMessage(const juce::MidiMessage& message)
         {
+            const juce::ScopedLock sl(outputLock);
             if (midiOut)
             {
                 midiOut->sendMessageNow(message);
@@ -150,12 +373,15 @@ namespace Midi
 
         void handleIncomingMidiMessage(juce::MidiInput* /*source*/, const juce::MidiMessage& message) override
         {
-            if (autoDisconnect)
+            // the watchdog compares this against the time: cheaper than restarting a timer
+            const double now = juce::Time::getMillisecondCounterHiRes();
+            lastTraffic.store(now, std::memory_order_relaxed);
+
+            if (processor.isEnabled())
             {
-                startTimer(0, TimeoutMilliseconds);
+                processor.post(message, now);
             }
-
-            if (message.isSysEx())
+            else if (message.isSysEx())
             {
                 const uint8_t* m = message.getSysExData();
                 const size_t s = message.getSysExDataSize();
@@ -171,109 +397,517 @@ namespace Midi
 
         void timerCallback(int timerID) override
         {
-            if (timerID != 0) return;
-
-            if (connectionState == State::Connected)
-            {
-                // hit this timer because data flow has stopped
-                if (autoDisconnect)
-                {
-                    disconnect();
-                }
-            }
-            else if (canConnect())
+            if (timerID == 0)
             {
-                if (!isConnected())
-                {
-                    if (autoReconnect)
-                    {
-                        connect();
-                    }
-                    else
-                    {
-                        setConnectionState(State::Available);
-                    }
-                }
-            }
-            else
-            {
-                setConnectionState(State::Unavailable);
+                service();
             }
         }
 
         // ------------------------------------------------------------------------
 
     protected:
+        // midiOut and midiIn belong to the device thread; midiOut is also read,
+        // under outputLock, by sendMessage()
         std::unique_ptr<juce::MidiOutput> midiOut;
         std::unique_ptr<juce::MidiInput> midiIn;
         juce::String device, bootloader;
-        State connectionState;
+        std::atomic<State> connectionState;
         bool autoReconnect, autoDisconnect;
+        juce::CriticalSection outputLock;
+        int pollMilliseconds;
+        std::atomic<bool> deviceWasAvailable;
+        std::atomic<double> deviceAppearedTime; // in juce::Time::getMillisecondCounterHiRes() units
+        juce::SharedResourcePointer<DeviceCache> devices;
+        std::atomic<int> missedFramesForDisconnect;
+        std::atomic<double> lastTraffic;
+        ArrivalStatistics stream;
+        juce::String pinnedOutput, pinnedInput;
+        bool externallyServiced;
 
         // ------------------------------------------------------------------------
 
         virtual void handleSysEx(const uint8_t* /*data*/, const size_t /*numBytes*/) {}
         virtual void handleMidi(const juce::MidiMessage& /*message*/) {}
         virtual void connectionStateChanged() {}
-        
+
+        /** Called on the device thread once the device is open, before any input
+            arrives and before connectionStateChanged(). Anything sent from here
+            goes out without waiting for the message thread. */
+        virtual void deviceOpened() {}
+
         // ------------------------------------------------------------------------
 
+        /** Derived classes call this from the MIDI thread for each frame of a
+            regular stream (such as orientation data), so that the watchdog can
+            learn the frame rate. */
+        void noteStreamFrame()
+        {
+            stream.noteArrival(juce::Time::getMillisecondCounterHiRes());
+        }
+
+        /** Call when the stream stops or changes rate, so that the watchdog falls
+            back to TimeoutMilliseconds until it has learned the new rate. Any
+            thread: the statistics themselves are cleared by the next
+            noteStreamFrame(), so they only ever have one writer. */
+        void forgetStreamRate()
+        {
+            stream.reset();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Stops the device and processing threads and closes the device. A
+            derived class that overrides deviceOpened() or handles input should
+            call this from its own destructor, so that neither runs while it is
+            being destroyed. */
+        void shutDownDevices()
+        {
+            deviceThread.remove(&deviceJob);
+            closeDevices();
+            processor.stop();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** For the message thread: changes of availability that don't involve
+            opening or closing the device. */
         void setConnectionState(State newState)
         {
-            if (newState != connectionState)
+            if (newState != connectionState.load())
             {
-                connectionState = newState;
-                connectionStateChanged();
+                publishState(newState);
+                stateNotifier.handleUpdateNowIfNeeded();
             }
         }
-        
+
         // ------------------------------------------------------------------------
-        
-        juce::String findIdentifierInMidiInfo(const juce::Array<juce::MidiDeviceInfo>& mdInfo, juce::String deviceName) const
+
+        /** Looks for the device in the cached lists, and updates the state (or
+            connects) to match. Only for when the device isn't connected. */
+        void checkAvailability()
+        {
+            if (isConnecting())
+            {
+                return;
+            }
+            if (canConnect())
+            {
+                noteDeviceAppeared();
+                if (!isConnected())
+                {
+                    if (autoReconnect)
+                    {
+                        connectAsync();
+                    }
+                    else
+                    {
+                        setConnectionState(State::Available);
+                    }
+                }
+            }
+            else
+            {
+                deviceWasAvailable.store(false);
+                setConnectionState(State::Unavailable);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void midiDevicesChanged() override
         {
-            const int size = mdInfo.size();
-            int index = 0;
-            while ((index < size) && !(mdInfo[index].name.startsWith(deviceName)))
+            if (!isConnected())
             {
-                index++;
+                checkAvailability();
             }
-            return (index == size) ? juce::String() : mdInfo[index].identifier;
         }
 
         // ------------------------------------------------------------------------
 
         void getIdentifiers(bool& wouldConnectToBootloader, juce::String& outputIdentifier, juce::String& inputIdentifier) const
         {
-            const juce::Array<juce::MidiDeviceInfo>& outInfo = juce::MidiOutput::getAvailableDevices();
-            outputIdentifier = findIdentifierInMidiInfo(outInfo, device);
+            if (pinnedOutput.isNotEmpty())
+            {
+                wouldConnectToBootloader = false;
+                const bool present = devices->hasOutput(pinnedOutput) && devices->hasInput(pinnedInput);
+                outputIdentifier = present ? pinnedOutput : juce::String();
+                inputIdentifier = present ? pinnedInput : juce::String();
+                return;
+            }
+
+            outputIdentifier = devices->findOutput(device);
             if (outputIdentifier.isNotEmpty())
             {
                 wouldConnectToBootloader = false;
             }
             else
             {
-                outputIdentifier = findIdentifierInMidiInfo(outInfo, bootloader);
+                outputIdentifier = devices->findOutput(bootloader);
                 wouldConnectToBootloader = true;
             }
 
             inputIdentifier = juce::String();
             if (outputIdentifier.isNotEmpty())
             {
-                const juce::Array<juce::MidiDeviceInfo>& inInfo = juce::MidiInput::getAvailableDevices();
-                if (wouldConnectToBootloader)
+                inputIdentifier = devices->findInput(wouldConnectToBootloader ? bootloader : device);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        static constexpr int TimeoutMilliseconds = 600;
+        static constexpr int MinimumTimeoutMilliseconds = 30;
+        static constexpr int MinimumWatchdogPollMilliseconds = 10;
+        static constexpr int DefaultMissedFrames = 5;
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int DeviceThreadStopMilliseconds = 2000;
+
+        enum DeviceRequest : int { NoRequest, OpenRequest, CloseRequest };
+
+        /** Opens and closes the device on the device thread, so that nobody else
+            waits for it. */
+        class DeviceJob : public WorkerThread::Job
+        {
+        public:
+            DeviceJob(MidiDuplex& owner) : duplex(owner) {}
+            void runJob() override { duplex.serviceRequests(); }
+
+        private:
+            MidiDuplex& duplex;
+        };
+
+        /** Calls connectionStateChanged() on the message thread. */
+        class StateNotifier : public juce::AsyncUpdater
+        {
+        public:
+            StateNotifier(MidiDuplex& owner) : duplex(owner) {}
+            void handleAsyncUpdate() override { duplex.deliverStateChange(); }
+
+        private:
+            MidiDuplex& duplex;
+        };
+
+        /** Handles input, when setProcessingThread() asks for it: drains the
+            queue each time the MIDI callback wakes it. */
+        class ProcessingThread : public juce::Thread
+        {
+        public:
+            ProcessingThread(MidiDuplex& owner) :
+                juce::Thread("MIDI processing"),
+                duplex(owner),
+                enabled(false),
+                priority(0),
+                affinity(0),
+                averageWake(0.0),
+                worstWake(0.0),
+                wakes(0),
+                dropped(0),
+                tooLong(0),
+                realtime(false)
+            {}
+
+            bool isEnabled() const
+            {
+                return enabled.load(std::memory_order_acquire);
+            }
+
+            void start(const int realtimePriority, const uint32_t affinityMask)
+            {
+                priority = realtimePriority;
+                affinity = affinityMask;
+                queue.clear();
+                averageWake.store(0.0);
+                worstWake.store(0.0);
+                wakes.store(0);
+                dropped.store(0);
+                tooLong.store(0);
+                realtime.store(false);
+                startThread();
+                enabled.store(true, std::memory_order_release);
+            }
+
+            /** Only while the device is closed, so that nothing is being posted. */
+            void stop()
+            {
+                enabled.store(false);
+                signalThreadShouldExit();
+                notify();
+                stopThread(DeviceThreadStopMilliseconds);
+                queue.clear();
+            }
+
+            /** On the MIDI thread. Never waits for the consumer, but notify()
+                briefly takes the thread event's mutex. */
+            void post(const juce::MidiMessage& message, const double arrivalTime)
+            {
+                const size_t numBytes = static_cast<size_t>(message.getRawDataSize());
+                if (numBytes > RawQueue::MaxMessageBytes)
                 {
-                    inputIdentifier = findIdentifierInMidiInfo(inInfo, bootloader);
+                    tooLong.fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (queue.push(message.getRawData(), numBytes, arrivalTime))
+                {
+                    notify();
                 }
                 else
                 {
-                    inputIdentifier = findIdentifierInMidiInfo(inInfo, device);
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            ProcessingMetrics getMetrics() const
+            {
+                ProcessingMetrics m;
+                m.averageWakeMilliseconds = averageWake.load();
+                m.worstWakeMilliseconds = worstWake.load();
+                m.messagesDropped = dropped.load();
+                m.messagesTooLong = tooLong.load();
+                m.isRealtime = realtime.load();
+                return m;
+            }
+
+            void run() override
+            {
+                applyScheduling();
+                while (!threadShouldExit())
+                {
+                    wait(-1);
+                    bool woken = true;
+                    while (const RawQueue::Record* r = queue.peek())
+                    {
+                        if (woken)
+                        {
+                            noteWake(juce::Time::getMillisecondCounterHiRes() - r->arrivalTime);
+                            woken = false;
+                        }
+                        duplex.dispatch(r->data, r->numBytes);
+                        queue.release();
+                    }
+                }
+            }
+
+        private:
+            static constexpr double Smoothing = 1.0 / 64.0;
+
+            MidiDuplex& duplex;
+            RawQueue queue;
+            std::atomic<bool> enabled;
+            int priority;
+            uint32_t affinity;
+            std::atomic<double> averageWake, worstWake; // written by this thread only
+            std::atomic<uint64_t> wakes;
+            std::atomic<uint64_t> dropped;
+            std::atomic<uint64_t> tooLong;
+            std::atomic<bool> realtime;
+
+            void applyScheduling()
+            {
+               #if JUCE_LINUX
+                if (priority > 0)
+                {
+                    sched_param param {};
+                    param.sched_priority = juce::jlimit(sched_get_priority_min(SCHED_FIFO),
+                                                        sched_get_priority_max(SCHED_FIFO), priority);
+                    realtime.store(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+                }
+               #endif
+                if (affinity != 0)
+                {
+                    juce::Thread::setCurrentThreadAffinityMask(affinity);
                 }
             }
+
+            void noteWake(const double milliseconds)
+            {
+                const uint64_t n = wakes.fetch_add(1, std::memory_order_relaxed);
+                const double average = averageWake.load(std::memory_order_relaxed);
+                averageWake.store((n == 0) ? milliseconds : average + (milliseconds - average) * Smoothing,
+                                  std::memory_order_relaxed);
+                if (milliseconds > worstWake.load(std::memory_order_relaxed))
+                {
+                    worstWake.store(milliseconds, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        std::atomic<int> pendingRequest; // the latest request wins
+        std::atomic<bool> working;
+        std::atomic<uint32_t> stateChanges;
+        uint32_t stateChangesDelivered;
+        juce::WaitableEvent requestsServed;
+        std::unique_ptr<WorkerThread> ownDeviceThread; // only if none is shared
+        WorkerThread& deviceThread;
+        DeviceJob deviceJob;
+        StateNotifier stateNotifier;
+        ProcessingThread processor;
+
+        // ------------------------------------------------------------------------
+
+        void scheduleService(const int milliseconds)
+        {
+            if (!externallyServiced && (getTimerInterval(0) != milliseconds))
+            {
+                startTimer(0, milliseconds);
+            }
         }
 
         // ------------------------------------------------------------------------
 
-    private:
-        static constexpr int TimeoutMilliseconds = 600;
+        /** A raw message from the processing thread's queue. */
+        void dispatch(const uint8_t* data, const size_t numBytes)
+        {
+            if ((numBytes >= 2) && (data[0] == 0xf0))
+            {
+                // as juce::MidiMessage::getSysExData(): without the 0xf0 and 0xf7
+                handleSysEx(data + 1, numBytes - ((data[numBytes - 1] == 0xf7) ? 2 : 1));
+            }
+            else
+            {
+                handleMidi(juce::MidiMessage(data, static_cast<int>(numBytes)));
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void post(const DeviceRequest request)
+        {
+            pendingRequest.store(request);
+            deviceThread.wake(deviceJob);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** On the device thread. As before, connecting always closes first. */
+        void serviceRequests()
+        {
+            working.store(true);
+            for (int request = pendingRequest.exchange(NoRequest); request != NoRequest;
+                     request = pendingRequest.exchange(NoRequest))
+            {
+                closeDevices();
+                if ((request != OpenRequest) || !openDevices())
+                {
+                    publishState(State::Unavailable);
+                }
+            }
+            working.store(false);
+            requestsServed.signal();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** On the message thread: blocks until the device thread has served every
+            request, then delivers the state change at once. Gives up after
+            DeviceThreadStopMilliseconds rather than hang on a stuck driver. */
+        void waitForDeviceThread()
+        {
+            const juce::uint32 deadline = juce::Time::getMillisecondCounter() + DeviceThreadStopMilliseconds;
+            while (isConnecting())
+            {
+                const int remaining = static_cast<int>(deadline - juce::Time::getMillisecondCounter());
+                if ((remaining <= 0) || !requestsServed.wait(remaining))
+                {
+                    break;
+                }
+            }
+            stateNotifier.handleUpdateNowIfNeeded();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** On the device thread. Returns true, having published the new state, if
+            both ports opened. */
+        bool openDevices()
+        {
+            juce::String outputIdentifier, inputIdentifier;
+            bool connectingToBootloader = false;
+            getIdentifiers(connectingToBootloader, outputIdentifier, inputIdentifier);
+            if (outputIdentifier.isEmpty() || inputIdentifier.isEmpty())
+            {
+                return false;
+            }
+
+            std::unique_ptr<juce::MidiOutput> newOut = juce::MidiOutput::openDevice(outputIdentifier);
+            std::unique_ptr<juce::MidiInput> newIn = juce::MidiInput::openDevice(inputIdentifier, this);
+            if (!newOut || !newIn)
+            {
+                return false;
+            }
+
+            {
+                const juce::ScopedLock sl(outputLock);
+                midiOut = std::move(newOut);
+            }
+            midiIn = std::move(newIn);
+            noteDeviceAppeared();
+            stream.reset();
+            lastTraffic.store(juce::Time::getMillisecondCounterHiRes()); // the first frame has TimeoutMilliseconds to arrive
+
+            // connected from here on, so that anything sent by deviceOpened() goes out
+            connectionState.store(connectingToBootloader ? State::Bootloader : State::Connected);
+            deviceOpened();
+            midiIn->start();
+            publishState(connectionState.load());
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void closeDevices()
+        {
+            if (midiIn || midiOut)
+            {
+                // whatever happens next, the device has to be seen again to
+                // count as having appeared
+                deviceWasAvailable.store(false);
+            }
+            if (midiIn)
+            {
+                midiIn->stop();
+            }
+            midiIn = nullptr;
+            const juce::ScopedLock sl(outputLock);
+            midiOut = nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void noteDeviceAppeared()
+        {
+            if (!deviceWasAvailable.exchange(true))
+            {
+                deviceAppearedTime.store(juce::Time::getMillisecondCounterHiRes());
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Any thread. Every call produces a connectionStateChanged(), even if the
+            state is the same as before (when reconnecting, say). */
+        void publishState(const State newState)
+        {
+            connectionState.store(newState);
+            stateChanges.fetch_add(1);
+            stateNotifier.triggerAsyncUpdate();
+        }
+
+        // ------------------------------------------------------------------------
+
+        void deliverStateChange()
+        {
+            const uint32_t changes = stateChanges.load();
+            if (changes != stateChangesDelivered)
+            {
+                stateChangesDelivered = changes;
+                if (isConnected())
+                {
+                    scheduleService(TimeoutMilliseconds); // give the first frame time to arrive
+                }
+                connectionStateChanged();
+            }
+        }
     };
 };
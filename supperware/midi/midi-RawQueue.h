@@ -0,0 +1,87 @@
+/*
+ * MIDI drivers
+ * Single-producer, single-consumer queue of timestamped MIDI messages
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Carries raw MIDI messages, each with its arrival time, from the thread
+        that receives them to a thread that processes them. One thread pushes
+        and one pops; neither waits or allocates. If the queue is full, or a
+        message is too long for a slot, push() fails and the message is lost;
+        callers that care which should check the length first. */
+    class RawQueue
+    {
+    public:
+        static constexpr size_t MaxMessageBytes = 64; // the tracker's longest is 25
+        static constexpr uint32_t Capacity = 256;     // a power of two
+
+        struct Record
+        {
+            double arrivalTime; // juce::Time::getMillisecondCounterHiRes()
+            uint32_t numBytes;
+            uint8_t data[MaxMessageBytes];
+        };
+
+        RawQueue() :
+            writeCount(0),
+            readCount(0)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** Producer only. */
+        bool push(const uint8_t* data, const size_t numBytes, const double arrivalTime)
+        {
+            const uint32_t w = writeCount.load(std::memory_order_relaxed);
+            if ((numBytes > MaxMessageBytes) || (w - readCount.load(std::memory_order_acquire) >= Capacity))
+            {
+                return false;
+            }
+            Record& r = records[w & (Capacity - 1)];
+            r.arrivalTime = arrivalTime;
+            r.numBytes = static_cast<uint32_t>(numBytes);
+            std::memcpy(r.data, data, numBytes);
+            writeCount.store(w + 1, std::memory_order_release);
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Consumer only. Returns the oldest record, or nullptr if there are none.
+            The record stays valid until release() is called. */
+        const Record* peek() const
+        {
+            const uint32_t r = readCount.load(std::memory_order_relaxed);
+            if (r == writeCount.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+            return &records[r & (Capacity - 1)];
+        }
+
+        /** Consumer only: finishes with the record returned by peek(). */
+        void release()
+        {
+            readCount.store(readCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Only when neither thread is using the queue. */
+        void clear()
+        {
+            readCount.store(writeCount.load());
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        Record records[Capacity];
+        std::atomic<uint32_t> writeCount;
+        std::atomic<uint32_t> readCount;
+    };
+};
@@ -0,0 +1,260 @@
+/*
+ * MIDI drivers
+ * Configuration writes that are confirmed by reading them back
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** A configuration change, and how to tell whether the head tracker took it.
+        The readback replies don't identify the request that caused them, so a
+        request is answered by the first reply to each of its parameters that
+        arrives after it was sent. If verify() then fails (an older reply got
+        there first, say) the request is simply sent again. */
+    struct Request
+    {
+        using Completion = std::function<void(bool /*succeeded*/)>;
+
+        /** Posts the configuration write(s). Called again on each retry; may be empty
+            for a plain readback. */
+        std::function<void()> write;
+
+        /** The parameters to read back afterwards (see Tracker::readbackBit). */
+        uint32_t readbackMask = Tracker::DefaultReadbackMask;
+
+        /** Returns true if the state read back shows that the write took effect.
+            May be empty, in which case any reply will do. */
+        std::function<bool(const Tracker::State&)> verify;
+
+        /** Called on the message thread once the request has succeeded, or has
+            failed after its last retry. May be empty. */
+        Completion completion;
+
+        int timeoutMilliseconds = 250;
+        int retries = 2;
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Requests that are waiting for their readbacks. Everything here runs on the
+        message thread, apart from noteReadback() and isBusy(), which are called
+        from the MIDI thread. Any number of requests can be in flight together:
+        their writes go out in one burst and share one readback message. */
+    class RequestList
+    {
+    public:
+        static constexpr uint8_t NumParameters = 32;
+
+        /** How many replies had arrived for each parameter at some moment. */
+        struct Snapshot
+        {
+            uint32_t arrivals[NumParameters];
+            double time;
+        };
+
+        /** trackerState is read on the message thread, in service(), so it
+            must be a message-thread copy. */
+        RequestList(CommandQueue& commandQueue, const Tracker::State& trackerState) :
+            commands(commandQueue),
+            state(trackerState),
+            numOutstanding(0)
+        {
+            for (std::atomic<uint32_t>& a: arrivals)
+            {
+                a.store(0);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void submit(Request request)
+        {
+            Outstanding o;
+            o.request = std::move(request);
+            o.attemptsLeft = o.request.retries + 1;
+            send(o);
+            outstanding.push_back(std::move(o));
+            numOutstanding.store(static_cast<int>(outstanding.size()));
+            commands.flush();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Any thread: take this just before posting a readback outside the
+            list, to adopt() it afterwards. */
+        Snapshot snapshot() const
+        {
+            Snapshot s;
+            for (uint8_t p = 0; p < NumParameters; ++p)
+            {
+                s.arrivals[p] = arrivals[p].load(std::memory_order_acquire);
+            }
+            s.time = juce::Time::getMillisecondCounterHiRes();
+            return s;
+        }
+
+        /** Like submit(), for a request whose first write and readback were
+            already posted, just after sentAt was taken: it is only tracked
+            from then on, and sent again only if it needs retrying. */
+        void adopt(Request request, const Snapshot& sentAt)
+        {
+            Outstanding o;
+            o.request = std::move(request);
+            o.attemptsLeft = o.request.retries;
+            std::copy(sentAt.arrivals, sentAt.arrivals + NumParameters, o.arrivalsWhenSent);
+            o.deadline = sentAt.time + o.request.timeoutMilliseconds;
+            outstanding.push_back(std::move(o));
+            numOutstanding.store(static_cast<int>(outstanding.size()));
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Completes any requests that have been answered, and retries or fails any
+            that have timed out. Returns true if requests are still outstanding. */
+        bool service()
+        {
+            const double now = juce::Time::getMillisecondCounterHiRes();
+            std::vector<std::pair<Request::Completion, bool>> finished;
+            bool resent = false;
+
+            for (size_t i = 0; i < outstanding.size();)
+            {
+                Outstanding& o = outstanding[i];
+                bool done = false, succeeded = false;
+                if (hasBeenAnswered(o))
+                {
+                    if (!o.request.verify || o.request.verify(state))
+                    {
+                        done = succeeded = true;
+                    }
+                    else if (o.attemptsLeft > 0)
+                    {
+                        send(o);
+                        resent = true;
+                    }
+                    else
+                    {
+                        done = true;
+                    }
+                }
+                else if (now >= o.deadline)
+                {
+                    if (o.attemptsLeft > 0)
+                    {
+                        send(o);
+                        resent = true;
+                    }
+                    else
+                    {
+                        done = true;
+                    }
+                }
+
+                if (done)
+                {
+                    finished.emplace_back(std::move(o.request.completion), succeeded);
+                    outstanding.erase(outstanding.begin() + static_cast<std::ptrdiff_t>(i));
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            numOutstanding.store(static_cast<int>(outstanding.size()));
+            if (resent)
+            {
+                commands.flush();
+            }
+
+            // completions are called last, as they may well submit more requests
+            for (auto& f: finished)
+            {
+                if (f.first) f.first(f.second);
+            }
+            return !outstanding.empty();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Fails everything that is outstanding: for when the device goes away. */
+        void cancelAll()
+        {
+            std::vector<Outstanding> cancelled;
+            cancelled.swap(outstanding);
+            numOutstanding.store(0);
+            for (Outstanding& o: cancelled)
+            {
+                if (o.request.completion) o.request.completion(false);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Call from the MIDI thread as each readback parameter arrives. */
+        void noteReadback(const uint8_t parameter)
+        {
+            if (parameter < NumParameters)
+            {
+                arrivals[parameter].fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isBusy() const
+        {
+            return numOutstanding.load() > 0;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        struct Outstanding
+        {
+            Request request;
+            uint32_t arrivalsWhenSent[NumParameters];
+            double deadline;
+            int attemptsLeft;
+        };
+
+        CommandQueue& commands;
+        const Tracker::State& state;
+        std::vector<Outstanding> outstanding;
+        std::atomic<uint32_t> arrivals[NumParameters];
+        std::atomic<int> numOutstanding;
+
+        // ------------------------------------------------------------------------
+
+        void send(Outstanding& o)
+        {
+            --o.attemptsLeft;
+            for (uint8_t p = 0; p < NumParameters; ++p)
+            {
+                o.arrivalsWhenSent[p] = arrivals[p].load(std::memory_order_acquire);
+            }
+            o.deadline = juce::Time::getMillisecondCounterHiRes() + o.request.timeoutMilliseconds;
+            if (o.request.write)
+            {
+                o.request.write();
+            }
+            commands.postReadback(o.request.readbackMask);
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool hasBeenAnswered(const Outstanding& o) const
+        {
+            for (uint8_t p = 0; p < NumParameters; ++p)
+            {
+                if ((o.request.readbackMask & (1u << p)) &&
+                    (arrivals[p].load(std::memory_order_acquire) == o.arrivalsWhenSent[p]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+};
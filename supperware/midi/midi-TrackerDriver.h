@@ -9,7 +9,7 @@
 
 namespace Midi
 {
-    class TrackerDriver: public MidiDuplex, Tracker::Listener
+    class TrackerDriver: public MidiDuplex, public Tracker::Listener, private juce::AsyncUpdater
     {
     public:
         class Listener
@@ -21,6 +21,7 @@ namespace Midi
             virtual void trackerOrientation(float /*yawRadian*/, float /*pitchRadian*/, float /*rollRadian*/) {}
             virtual void trackerOrientationQ(float /*qw*/, float /*qx*/, float /*qy*/, float /*qz*/) {}
             virtual void trackerOrientationM(float* /*matrix*/) {}
+            /** Message-thread listeners are given every change, in order. */
             virtual void trackerCompassStateChanged(Tracker::CompassState /*compassState*/) {}
             virtual void trackerConnectionChanged(const Tracker::State& /*state*/) {}
 
@@ -28,99 +29,274 @@ namespace Midi
             virtual void trackerMidiConnectionChanged(Midi::State /*state*/) {}
         };
 
-        TrackerDriver() :
-            MidiDuplex("Head Tracker", "Supperware Bootloader"),
+        /** A standalone driver runs its own device and sender threads. Several
+            drivers can share one of each instead (see TrackerManager). */
+        TrackerDriver(WorkerThread* sharedDeviceThread = nullptr, WorkerThread* sharedSenderThread = nullptr) :
+            MidiDuplex("Head Tracker", "Supperware Bootloader", sharedDeviceThread),
             tracker(this),
             currentAngleMode(Tracker::AngleMode::Quaternion),
             is100Hz(false),
-            isTrackerOn(false)
+            isTrackerOn(false),
+            commands(*this, tracker, sharedSenderThread),
+            requests(commands, messageState),
+            fastConnect(false),
+            awaitingFirstFrame(false),
+            connectedTime(0.0),
+            firstFrameTime(0.0),
+            appearedTime(0.0),
+            pendingNotifications(0),
+            compassFifo(CompassFifoSize),
+            latestCompassState(0),
+            compassOverflow(false),
+            publishing(false)
         {}
 
         // ------------------------------------------------------------------------
 
-        // pass through to our listener
+        ~TrackerDriver()
+        {
+            shutDownDevices();
+            cancelPendingUpdate();
+            stopTimer(RequestTimerID);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** When externally serviced, the owner's timer also drives the retries and
+            timeouts of confirmed requests, which otherwise have a timer of their
+            own while any are in flight. */
+        void service() override
+        {
+            MidiDuplex::service();
+            if (isExternallyServiced())
+            {
+                serviceRequests();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        // pass through to our listeners: realtime ones now, the others later
         void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
         {
-            for (Listener* l: listeners)
+            listeners.callRealtime([&](Listener* l) { l->trackerOrientation(yawRadian, pitchRadian, rollRadian); });
+            const float ypr[3] = { yawRadian, pitchRadian, rollRadian };
+            noteFrame();
+            if (publishing.load(std::memory_order_acquire))
             {
-                l->trackerOrientation(yawRadian, pitchRadian, rollRadian);
+                busHead.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+                publishFrame();
             }
+            latestYPR.post(ypr);
+            notifyMessageThread(PendingYPR);
         }
         void trackerOrientationQ(float qw, float qx, float qy, float qz) override
         {
-            for (Listener* l: listeners)
+            listeners.callRealtime([&](Listener* l) { l->trackerOrientationQ(qw, qx, qy, qz); });
+            const float q[4] = { qw, qx, qy, qz };
+            noteFrame();
+            if (publishing.load(std::memory_order_acquire))
             {
-                l->trackerOrientationQ(qw, qx, qy, qz);
+                busHead.setOrientationQuaternion(qw, qx, qy, qz);
+                publishFrame();
             }
+            latestQuaternion.post(q);
+            notifyMessageThread(PendingQuaternion);
         }
         void trackerOrientationM(float* matrix) override
         {
-            for (Listener* l: listeners)
+            listeners.callRealtime([&](Listener* l) { l->trackerOrientationM(matrix); });
+            noteFrame();
+            if (publishing.load(std::memory_order_acquire))
             {
-                l->trackerOrientationM(matrix);
+                busHead.setOrientationMatrix(matrix);
+                publishFrame();
             }
+            latestMatrix.post(matrix);
+            notifyMessageThread(PendingMatrix);
         }
         void trackerCompassStateChanged(Tracker::CompassState compassState) override
         {
-            for (Listener* l: listeners)
+            postState();
+            listeners.callRealtime([&](Listener* l) { l->trackerCompassStateChanged(compassState); });
+            // message-thread listeners see every step (Calibrating, then Succeeded,
+            // say), not only the state the tracker has reached by the time they run
+            int start1, size1, start2, size2;
+            compassFifo.prepareToWrite(1, start1, size1, start2, size2);
+            if (size1 > 0)
             {
-                l->trackerCompassStateChanged(compassState);
+                compassStates[start1] = compassState;
+                compassFifo.finishedWrite(1);
             }
+            else
+            {
+                latestCompassState.store(static_cast<int>(compassState));
+                compassOverflow.store(true, std::memory_order_release);
+            }
+            notifyMessageThread(PendingCompassState);
         }
         void trackerConnectionChanged(const Tracker::State& state) override
         {
-            for (Listener* l: listeners)
+            postState();
+            listeners.callRealtime([&](Listener* l) { l->trackerConnectionChanged(state); });
+            notifyMessageThread(PendingConnection);
+        }
+        void trackerReadback(uint8_t parameter) override
+        {
+            postState();
+            requests.noteReadback(parameter);
+            if (requests.isBusy())
+            {
+                pendingNotifications.fetch_or(PendingReadback);
+                triggerAsyncUpdate();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Listeners may be added and removed at any time from any non-realtime
+            thread, including while data is arriving. Realtime listeners are called
+            on the MIDI thread (or the driver's own thread: see
+            setProcessingThread); message thread listeners receive only the most
+            recent frame when they are called. */
+        void addListener(Listener* listener, const Dispatch dispatch = Dispatch::Realtime)
+        {
+            listeners.add(listener, dispatch);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** After this returns the listener will not be called again. Do not call
+            this from a realtime callback. */
+        void removeListener(Listener* listener)
+        {
+            listeners.remove(listener);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Times, in milliseconds, of the last connection. Each is negative
+            until it has been measured, and the times from appearing are also
+            negative if the device wasn't seen to appear afresh for this
+            connection (on reconnecting, say). The device counts as having appeared when
+            it was noticed: straight away where the system reports hot-plugging,
+            but otherwise at the next poll of the device list, so the times
+            from appearing are understated by up to one poll interval (see
+            setAvailabilityPollInterval). */
+        struct ConnectMetrics
+        {
+            double appearedToConnected;
+            double connectedToFirstFrame;
+            double appearedToFirstFrame;
+        };
+
+        ConnectMetrics getConnectMetrics() const
+        {
+            const double connected = connectedTime.load();
+            const double firstFrame = firstFrameTime.load();
+            const double appeared = appearedTime.load();
+            const bool hasFrame = !awaitingFirstFrame.load() && (firstFrame >= connected) && (connected > 0.0);
+            ConnectMetrics m;
+            const bool hasAppeared = (appeared > 0.0) && (connected > 0.0);
+            m.appearedToConnected   = hasAppeared ? (connected - appeared) : -1.0;
+            m.connectedToFirstFrame = hasFrame ? (firstFrame - connected) : -1.0;
+            m.appearedToFirstFrame  = (hasAppeared && hasFrame) ? (firstFrame - appeared) : -1.0;
+            return m;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** In fast-connect mode, the tracker is opened as soon as it appears. Its
+            turn-on message (using the settings last given to turnOn, or 50Hz
+            quaternions), any configuration set before, and a readback then go out
+            together in one burst. Turning fast connect off also turns off
+            automatic reconnection. */
+        void setFastConnect(const bool shouldConnectFast)
+        {
+            fastConnect = shouldConnectFast;
+            setAutoReconnect(fastConnect);
+            if (fastConnect)
             {
-                l->trackerConnectionChanged(state);
+                setAvailabilityPollInterval(FastPollMilliseconds);
+            }
+            else
+            {
+                resetAvailabilityPollInterval();
+            }
+            if (fastConnect && (connectionState == State::Available))
+            {
+                connectAsync();
             }
         }
 
         // ------------------------------------------------------------------------
 
-        void addListener(Listener* listener)
+        /** Publishes every frame to a shared-memory orientation bus (see
+            OrientationBus.h), so that other processes on this machine can follow
+            the head without opening the MIDI port. The bus is opened the first
+            time publishing is turned on. Returns false if it couldn't be opened. */
+        bool setOrientationBusPublishing(const bool shouldPublish, const char* busName = OrientationBus::DefaultName)
         {
-            listeners.push_back(listener);
+            if (shouldPublish && !bus.isOpen() && !bus.open(busName))
+            {
+                return false;
+            }
+            publishing.store(shouldPublish, std::memory_order_release); // after bus is open
+            return true;
         }
 
         // ------------------------------------------------------------------------
 
+        /** The configuration as the head tracker last reported it. Call on the
+            message thread only (refreshing the copy writes to it): this is a copy,
+            handed over from the MIDI thread, which keeps its own. */
         const Tracker::State& getState() const
         {
-            return tracker.getState();
+            return syncState();
         }
 
         // ------------------------------------------------------------------------
 
+        // The commands below are queued, and sent by the CommandQueue's thread.
+        // They return immediately and never block. The configuration setters
+        // each ask for a readback too, and getState() changes only when the
+        // tracker's reply arrives.
+
+        // ------------------------------------------------------------------------
+
         /** Stops sending data, without disconnecting. */
         void turnOff()
         {
             if (isTrackerOn)
             {
                 isTrackerOn = false;
-                size_t numBytes = tracker.turnOffMessage(midiBuffer);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                forgetStreamRate();
+                uint8_t message[CommandQueue::MaxMessageBytes];
+                size_t numBytes = tracker.turnOffMessage(message);
+                commands.post(Command::Power, message, numBytes);
             }
         }
 
         // ------------------------------------------------------------------------
 
         /** If set100Hz is false, the tracker responds at 50Hz.
-            These settings are remembered if you enable setAutoDisconnect / setAutoReconnect. */
+            These settings are remembered if you enable setAutoDisconnect / setAutoReconnect.
+            If the tracker isn't connected yet, it is connected first, and turned
+            on as soon as it has been opened. */
         void turnOn(bool is100HzMode = false, bool isQuaternionMode = true)
         {
-            if (connectionState != State::Connected)
-            {
-                connect();
-            }
-
             currentAngleMode = isQuaternionMode ? Tracker::AngleMode::Quaternion : Tracker::AngleMode::YPR;
+            is100Hz = is100HzMode;
+            isTrackerOn = true;
 
             if (connectionState == State::Connected)
             {
-                is100Hz = is100HzMode;
-                isTrackerOn = true;
-                size_t numBytes = tracker.turnOnMessage(midiBuffer, currentAngleMode, is100Hz);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                postTurnOn();
+                commands.flush();
+            }
+            else if (!isConnecting())
+            {
+                connectAsync();
             }
         }
 
@@ -129,8 +305,9 @@ namespace Midi
         /** Centres the head tracker. */
         void zero()
         {
-            size_t numBytes = tracker.zeroMessage(midiBuffer);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.zeroMessage(message);
+            commands.post(Command::Zero, message, numBytes);
         }
 
         // ------------------------------------------------------------------------
@@ -138,8 +315,10 @@ namespace Midi
         /** Determines whether the cable should be over the left or right ear. */
         void setChirality(const bool isRightEarChirality)
         {
-            size_t numBytes = tracker.chiralityMessage(midiBuffer, isRightEarChirality);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.chiralityMessage(message, isRightEarChirality, Tracker::UpdateMode::DontUpdateState);
+            commands.post(Command::Chirality, message, numBytes);
+            commands.postReadback(Tracker::readbackBit(Tracker::Readback::GestureAndChirality));
         }
         
         // ------------------------------------------------------------------------
@@ -147,8 +326,10 @@ namespace Midi
         /** Automatic zeroing modes (work only when the compass is off). */
         void setTravelMode(const Tracker::TravelMode newTravelMode)
         {
-            size_t numBytes = tracker.travelModeMessage(midiBuffer, newTravelMode);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.travelModeMessage(message, newTravelMode, Tracker::UpdateMode::DontUpdateState);
+            commands.post(Command::TravelMode, message, numBytes);
+            commands.postReadback(Tracker::readbackBit(Tracker::Readback::TravelMode));
         }
 
         // ------------------------------------------------------------------------
@@ -157,8 +338,11 @@ namespace Midi
             This state can be read back with getCompassState(). */
         void setCompass(bool compassShouldBeOn, bool compassShouldApplyYawCorrection)
         {
-            size_t numBytes = tracker.compassMessage(midiBuffer, compassShouldBeOn, compassShouldApplyYawCorrection);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.compassMessage(message, compassShouldBeOn, compassShouldApplyYawCorrection,
+                                                     Tracker::UpdateMode::DontUpdateState);
+            commands.post(Command::Compass, message, numBytes);
+            commands.postReadback(Tracker::readbackBit(Tracker::Readback::Compass));
         }
         
         // ------------------------------------------------------------------------
@@ -166,8 +350,10 @@ namespace Midi
         /** Turn shake-to-zero gesture on or off. */
         void setGestures(bool shakeToZero)
         {
-            size_t numBytes = tracker.gestureMessage(midiBuffer, shakeToZero);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.gestureMessage(message, shakeToZero, Tracker::UpdateMode::DontUpdateState);
+            commands.post(Command::Gesture, message, numBytes);
+            commands.postReadback(Tracker::readbackBit(Tracker::Readback::GestureAndChirality));
         }
 
         // ------------------------------------------------------------------------
@@ -175,16 +361,99 @@ namespace Midi
         /** Change central pull speed. */
         void setPullSpeed(unsigned char pullSpeed)
         {
-            size_t numBytes = tracker.pullSpeedMessage(midiBuffer, pullSpeed);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.pullSpeedMessage(message, pullSpeed, Tracker::UpdateMode::DontUpdateState);
+            commands.post(Command::PullSpeed, message, numBytes);
+            commands.postReadback(Tracker::readbackBit(Tracker::Readback::PullSpeed));
         }
 
         // ------------------------------------------------------------------------
         /** Put compass in calibration mode. */
         void calibrateCompass()
         {
-            size_t numBytes = tracker.calibrateCompassMessage(midiBuffer);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.calibrateCompassMessage(message);
+            commands.post(Command::CalibrateCompass, message, numBytes);
+        }
+
+        // ------------------------------------------------------------------------
+        // Confirmed versions of the setters above. Each write is followed by a
+        // readback, retried if the reply doesn't match, and the completion is called
+        // on the message thread with the outcome. Several can be in flight at once.
+        // Call these, and submit(), from the message thread.
+
+        /** Sends any request: see Midi::Request. */
+        void submit(Request request)
+        {
+            requests.submit(std::move(request));
+            if (!isExternallyServiced())
+            {
+                startTimer(RequestTimerID, RequestTickMilliseconds);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Reads back the given parameters (see Tracker::readbackBit). */
+        void refresh(Request::Completion completion, const uint32_t parameterMask = Tracker::DefaultReadbackMask)
+        {
+            Request r;
+            r.readbackMask = parameterMask;
+            r.completion = std::move(completion);
+            submit(std::move(r));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setChirality(const bool isRightEarChirality, Request::Completion completion)
+        {
+            submitWrite([this, isRightEarChirality] { setChirality(isRightEarChirality); },
+                Tracker::Readback::GestureAndChirality,
+                [isRightEarChirality](const Tracker::State& s) { return s.rightEarChirality == isRightEarChirality; },
+                std::move(completion));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setTravelMode(const Tracker::TravelMode newTravelMode, Request::Completion completion)
+        {
+            submitWrite([this, newTravelMode] { setTravelMode(newTravelMode); },
+                Tracker::Readback::TravelMode,
+                [newTravelMode](const Tracker::State& s) { return s.travelMode == newTravelMode; },
+                std::move(completion));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setCompass(bool compassShouldBeOn, bool compassShouldApplyYawCorrection, Request::Completion completion)
+        {
+            submitWrite([this, compassShouldBeOn, compassShouldApplyYawCorrection] { setCompass(compassShouldBeOn, compassShouldApplyYawCorrection); },
+                Tracker::Readback::Compass,
+                [compassShouldBeOn, compassShouldApplyYawCorrection](const Tracker::State& s)
+                {
+                    return (s.compassOn == compassShouldBeOn) && (s.compassSlowCorrection == compassShouldApplyYawCorrection);
+                },
+                std::move(completion));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setGestures(bool shakeToZero, Request::Completion completion)
+        {
+            submitWrite([this, shakeToZero] { setGestures(shakeToZero); },
+                Tracker::Readback::GestureAndChirality,
+                [shakeToZero](const Tracker::State& s) { return s.gestureShakeToZero == shakeToZero; },
+                std::move(completion));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setPullSpeed(unsigned char pullSpeed, Request::Completion completion)
+        {
+            submitWrite([this, pullSpeed] { setPullSpeed(pullSpeed); },
+                Tracker::Readback::PullSpeed,
+                [pullSpeed](const Tracker::State& s) { return s.pullSpeed == (pullSpeed & 0x1f); },
+                std::move(completion));
         }
 
         // ------------------------------------------------------------------------
@@ -204,28 +473,284 @@ namespace Midi
 
         // ------------------------------------------------------------------------
 
+        void deviceOpened() override
+        {
+            // each appearance is measured against one connection only
+            appearedTime.store(deviceAppearedTime.exchange(0.0));
+            connectedTime.store(juce::Time::getMillisecondCounterHiRes());
+            awaitingFirstFrame.store(true);
+
+            // anything unsent belongs to the previous connection
+            commands.discardAll();
+
+            // one burst, straight from the device thread: turn-on, the restored
+            // configuration, then the readback, which connectionStateChanged()
+            // only starts tracking
+            if (fastConnect || isTrackerOn)
+            {
+                postTurnOn();
+            }
+            if (fastConnect)
+            {
+                for (Command c: { Command::Chirality, Command::Gesture, Command::Compass,
+                                  Command::PullSpeed, Command::TravelMode })
+                {
+                    commands.repost(c);
+                }
+            }
+            if (connectionState == State::Connected)
+            {
+                connectReadback = requests.snapshot();
+                commands.postReadback(Tracker::DefaultReadbackMask);
+            }
+            commands.flush();
+        }
+
+        // ------------------------------------------------------------------------
+
         void connectionStateChanged() override
         {
+            // anything unanswered belongs to the previous connection
+            requests.cancelAll();
             if (connectionState == State::Connected)
             {
-                size_t numBytes = tracker.readbackMessage(midiBuffer);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                // deviceOpened() sent the readback; retry it until the reply (and
+                // so trackerConnectionChanged) arrives
+                requests.adopt(Request(), connectReadback);
+                if (!isExternallyServiced())
+                {
+                    startTimer(RequestTimerID, RequestTickMilliseconds);
+                }
+            }
+            else
+            {
+                commands.discardAll();
+            }
+            const Midi::State newState = connectionState;
+            listeners.callRealtime([&](Listener* l) { l->trackerMidiConnectionChanged(newState); });
+            notifyMessageThread(PendingMidiConnection);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void timerCallback(int timerID) override
+        {
+            if (timerID == RequestTimerID)
+            {
+                serviceRequests();
+            }
+            else
+            {
+                MidiDuplex::timerCallback(timerID);
             }
-            for (Listener* l: listeners)
+        }
+
+        // ------------------------------------------------------------------------
+
+        void handleAsyncUpdate() override
+        {
+            const uint32_t pending = pendingNotifications.exchange(0);
+            float values[9];
+
+            if ((pending & PendingReadback) != 0)
             {
-                l->trackerMidiConnectionChanged(connectionState);
+                serviceRequests();
+            }
+
+            if ((pending & PendingMidiConnection) != 0)
+            {
+                const Midi::State newState = connectionState;
+                listeners.callMessageThread([&](Listener* l) { l->trackerMidiConnectionChanged(newState); });
+            }
+            if ((pending & PendingConnection) != 0)
+            {
+                const Tracker::State state = syncState();
+                listeners.callMessageThread([&](Listener* l) { l->trackerConnectionChanged(state); });
+            }
+            if ((pending & PendingCompassState) != 0)
+            {
+                int start1, size1, start2, size2;
+                compassFifo.prepareToRead(compassFifo.getNumReady(), start1, size1, start2, size2);
+                for (int i = 0; i < size1 + size2; ++i)
+                {
+                    const Tracker::CompassState compassState = compassStates[(i < size1) ? (start1 + i) : (start2 + i - size1)];
+                    listeners.callMessageThread([&](Listener* l) { l->trackerCompassStateChanged(compassState); });
+                }
+                compassFifo.finishedRead(size1 + size2);
+                if (compassOverflow.exchange(false, std::memory_order_acquire))
+                {
+                    // too many steps to keep: at least end on the latest
+                    const Tracker::CompassState compassState = static_cast<Tracker::CompassState>(latestCompassState.load());
+                    listeners.callMessageThread([&](Listener* l) { l->trackerCompassStateChanged(compassState); });
+                }
+            }
+            if (((pending & PendingYPR) != 0) && latestYPR.collect(values))
+            {
+                listeners.callMessageThread([&](Listener* l) { l->trackerOrientation(values[0], values[1], values[2]); });
+            }
+            if (((pending & PendingQuaternion) != 0) && latestQuaternion.collect(values))
+            {
+                listeners.callMessageThread([&](Listener* l) { l->trackerOrientationQ(values[0], values[1], values[2], values[3]); });
+            }
+            if (((pending & PendingMatrix) != 0) && latestMatrix.collect(values))
+            {
+                listeners.callMessageThread([&](Listener* l) { l->trackerOrientationM(values); });
             }
         }
 
         // ------------------------------------------------------------------------
 
     private:
-        std::vector<Listener*> listeners;
-        Tracker tracker;
+        enum PendingFlags : uint32_t
+        {
+            PendingYPR            = 0x01,
+            PendingQuaternion     = 0x02,
+            PendingMatrix         = 0x04,
+            PendingCompassState   = 0x08,
+            PendingConnection     = 0x10,
+            PendingMidiConnection = 0x20,
+            PendingReadback       = 0x40
+        };
+
+        static constexpr int RequestTimerID = 1; // MidiDuplex uses timer 0
+        static constexpr int FastPollMilliseconds = 50;
+        static constexpr int RequestTickMilliseconds = 20;
+        static constexpr size_t StateValues = 7;
+        static constexpr int CompassFifoSize = 8; // holds one fewer
+
+        ListenerList<Listener> listeners;
+        Tracker tracker;                    // its state belongs to the MIDI thread
+        mutable Tracker::State messageState;
         juce::Vector3D<float> position;
-        uint8_t midiBuffer[16];
-        Tracker::AngleMode currentAngleMode;
-        bool is100Hz;
-        bool isTrackerOn;
+        // also read on the device thread by deviceOpened()
+        std::atomic<Tracker::AngleMode> currentAngleMode;
+        std::atomic<bool> is100Hz;
+        std::atomic<bool> isTrackerOn;
+        CommandQueue commands;
+        RequestList requests;
+        // taken by deviceOpened() on the device thread, and handed to the message
+        // thread with the state change that follows it
+        RequestList::Snapshot connectReadback;
+
+        // connection timing
+        std::atomic<bool> fastConnect;
+        std::atomic<bool> awaitingFirstFrame;
+        std::atomic<double> connectedTime, firstFrameTime, appearedTime;
+
+        // handed from the MIDI thread to message-thread listeners
+        std::atomic<uint32_t> pendingNotifications;
+        Tracker::CompassState compassStates[CompassFifoSize];
+        juce::AbstractFifo compassFifo;
+        std::atomic<int> latestCompassState; // when compassFifo overflows
+        std::atomic<bool> compassOverflow;
+        Mailbox<3> latestYPR;
+        Mailbox<4> latestQuaternion;
+        Mailbox<9> latestMatrix;
+        mutable Mailbox<StateValues> latestState;
+
+        // shared-memory publishing, on the MIDI thread
+        std::atomic<bool> publishing;
+        OrientationBus::Writer bus;
+        HeadMatrix busHead;
+
+        // ------------------------------------------------------------------------
+
+        /** On the MIDI thread, whenever the tracker's state may have changed. */
+        void postState()
+        {
+            const Tracker::State& s = tracker.getState();
+            const float values[StateValues] = {
+                s.rightEarChirality ? 1.0f : 0.0f, s.compassOn ? 1.0f : 0.0f,
+                s.compassSlowCorrection ? 1.0f : 0.0f, s.gestureShakeToZero ? 1.0f : 0.0f,
+                static_cast<float>(s.pullSpeed), static_cast<float>(s.travelMode),
+                static_cast<float>(s.compassState)
+            };
+            latestState.post(values);
+        }
+
+        /** On the message thread: brings messageState up to date. */
+        const Tracker::State& syncState() const
+        {
+            float v[StateValues];
+            if (latestState.collect(v))
+            {
+                messageState.rightEarChirality = (v[0] != 0.0f);
+                messageState.compassOn = (v[1] != 0.0f);
+                messageState.compassSlowCorrection = (v[2] != 0.0f);
+                messageState.gestureShakeToZero = (v[3] != 0.0f);
+                messageState.pullSpeed = static_cast<unsigned char>(v[4]);
+                messageState.travelMode = static_cast<Tracker::TravelMode>(static_cast<int>(v[5]));
+                messageState.compassState = static_cast<Tracker::CompassState>(static_cast<int>(v[6]));
+            }
+            return messageState;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void postTurnOn()
+        {
+            isTrackerOn = true;
+            forgetStreamRate(); // the rate may be changing
+            uint8_t message[CommandQueue::MaxMessageBytes];
+            size_t numBytes = tracker.turnOnMessage(message, currentAngleMode, is100Hz);
+            commands.post(Command::Power, message, numBytes);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void publishFrame()
+        {
+            float q[4], m[9];
+            busHead.getQuaternion(q[0], q[1], q[2], q[3]);
+            busHead.getMatrix(m);
+            bus.publish(q, m);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void noteFrame()
+        {
+            noteStreamFrame();
+            if (awaitingFirstFrame.load(std::memory_order_relaxed) && awaitingFirstFrame.exchange(false))
+            {
+                firstFrameTime.store(juce::Time::getMillisecondCounterHiRes());
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void submitWrite(std::function<void()> write, const Tracker::Readback parameter,
+            std::function<bool(const Tracker::State&)> verify, Request::Completion completion)
+        {
+            Request r;
+            r.write = std::move(write);
+            r.readbackMask = Tracker::readbackBit(parameter);
+            r.verify = std::move(verify);
+            r.completion = std::move(completion);
+            submit(std::move(r));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void serviceRequests()
+        {
+            syncState();
+            if (!requests.service())
+            {
+                stopTimer(RequestTimerID);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void notifyMessageThread(const uint32_t flag)
+        {
+            if (listeners.has(Dispatch::MessageThread))
+            {
+                // AsyncUpdater coalesces: only the first of a burst posts a message
+                pendingNotifications.fetch_or(flag);
+                triggerAsyncUpdate();
+            }
+        }
     };
 };
@@ -0,0 +1,347 @@
+/*
+ * MIDI drivers
+ * Drives every head tracker that is plugged in
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Finds every head tracker on the system and runs one TrackerDriver for
+        each of them. Each tracker gets an ID when it is first seen, and keeps
+        it for as long as the manager exists, even if it is unplugged and
+        plugged in again (as long as the system gives its ports the same
+        identifiers). Listener callbacks carry the ID of the tracker they came
+        from.
+
+        All the drivers are watched, and their confirmed requests retried, from
+        one timer; they share one thread for opening and closing ports and one
+        for sending commands; and only the manager listens for changes to the
+        device lists. So the manager scales to dozens of trackers. Create it,
+        and call everything apart from getDriver()'s returned driver, on the
+        message thread. */
+    class TrackerManager : private DeviceCache::Listener, private juce::Timer
+    {
+    public:
+        using TrackerID = uint32_t;
+
+        class Listener
+        {
+        public:
+            virtual ~Listener() {}
+
+            /** The TrackerDriver::Listener callbacks, tagged with the tracker's ID. */
+            virtual void trackerOrientation(TrackerID /*id*/, float /*yawRadian*/, float /*pitchRadian*/, float /*rollRadian*/) {}
+            virtual void trackerOrientationQ(TrackerID /*id*/, float /*qw*/, float /*qx*/, float /*qy*/, float /*qz*/) {}
+            virtual void trackerOrientationM(TrackerID /*id*/, float* /*matrix*/) {}
+            virtual void trackerCompassStateChanged(TrackerID /*id*/, Tracker::CompassState /*compassState*/) {}
+            virtual void trackerConnectionChanged(TrackerID /*id*/, const Tracker::State& /*state*/) {}
+            virtual void trackerMidiConnectionChanged(TrackerID /*id*/, Midi::State /*state*/) {}
+
+            /** Called on the message thread as trackers are plugged in and unplugged. */
+            virtual void trackerAdded(TrackerID /*id*/) {}
+            virtual void trackerRemoved(TrackerID /*id*/) {}
+        };
+
+        // ------------------------------------------------------------------------
+
+        /** If autoConnect is true, each tracker is connected and turned on as soon
+            as it is found. */
+        TrackerManager(const bool autoConnect = true, const bool is100HzMode = false, const bool isQuaternionMode = true) :
+            deviceThread("Head tracker devices"),
+            senderThread("Head tracker output"),
+            connectAutomatically(autoConnect),
+            is100Hz(is100HzMode),
+            isQuaternion(isQuaternionMode),
+            nextID(1)
+        {
+            devices->addListener(this);
+            midiDevicesChanged();
+            startTimer(ServiceMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~TrackerManager()
+        {
+            stopTimer();
+            devices->removeListener(this);
+            trackers.clear();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** As with TrackerDriver, realtime listeners are called on the MIDI thread
+            of whichever tracker sent the data. */
+        void addListener(Listener* listener, const Dispatch dispatch = Dispatch::Realtime)
+        {
+            listeners.add(listener, dispatch);
+            updateMessageThreadForwarding();
+        }
+
+        void removeListener(Listener* listener)
+        {
+            listeners.remove(listener);
+            updateMessageThreadForwarding();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The IDs of the trackers that are plugged in, in the order they were found. */
+        std::vector<TrackerID> getTrackerIDs() const
+        {
+            std::vector<TrackerID> ids;
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                ids.push_back(e->id);
+            }
+            return ids;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The driver for a tracker, for changing its settings; nullptr if that
+            tracker isn't plugged in. Don't keep the pointer beyond trackerRemoved(). */
+        TrackerDriver* getDriver(const TrackerID id) const
+        {
+            const Entry* e = find(id);
+            return e ? e->driver.get() : nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int ServiceMilliseconds = 20;
+        static constexpr const char* DeviceName = "Head Tracker";
+
+        /** Passes one driver's callbacks on to the manager's listeners, with the
+            tracker's ID attached. Each driver has one of these per dispatch. */
+        class Forwarder : public TrackerDriver::Listener
+        {
+        public:
+            Forwarder(TrackerManager& owner, const TrackerID trackerID, const Dispatch forwardingDispatch) :
+                manager(owner), id(trackerID), dispatch(forwardingDispatch)
+            {}
+
+            void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerOrientation(id, yawRadian, pitchRadian, rollRadian); });
+            }
+            void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerOrientationQ(id, qw, qx, qy, qz); });
+            }
+            void trackerOrientationM(float* matrix) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerOrientationM(id, matrix); });
+            }
+            void trackerCompassStateChanged(Tracker::CompassState compassState) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerCompassStateChanged(id, compassState); });
+            }
+            void trackerConnectionChanged(const Tracker::State& state) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerConnectionChanged(id, state); });
+            }
+            void trackerMidiConnectionChanged(Midi::State state) override
+            {
+                call([&](TrackerManager::Listener* l) { l->trackerMidiConnectionChanged(id, state); });
+            }
+
+        private:
+            TrackerManager& manager;
+            TrackerID id;
+            Dispatch dispatch;
+
+            template <typename Function>
+            void call(Function&& function)
+            {
+                if (dispatch == Dispatch::Realtime)
+                {
+                    manager.listeners.callRealtime(function);
+                }
+                else
+                {
+                    manager.listeners.callMessageThread(function);
+                }
+            }
+        };
+
+        // ------------------------------------------------------------------------
+
+        struct Entry
+        {
+            Entry(TrackerManager& owner, const TrackerID trackerID, const juce::String& key) :
+                id(trackerID),
+                deviceKey(key),
+                realtime(owner, trackerID, Dispatch::Realtime),
+                messageThread(owner, trackerID, Dispatch::MessageThread),
+                driver(std::make_unique<TrackerDriver>(&owner.deviceThread, &owner.senderThread)),
+                forwardingToMessageThread(false)
+            {}
+
+            TrackerID id;
+            juce::String deviceKey;
+            Forwarder realtime, messageThread;
+            std::unique_ptr<TrackerDriver> driver; // after the forwarders, so it is destroyed first
+            bool forwardingToMessageThread;
+        };
+
+        juce::SharedResourcePointer<DeviceCache> devices;
+        ListenerList<Listener> listeners;
+        WorkerThread deviceThread, senderThread; // before trackers, so they outlive the drivers
+        std::vector<std::unique_ptr<Entry>> trackers;
+        std::map<juce::String, TrackerID> idsByDevice; // never forgets, so IDs are stable
+        bool connectAutomatically, is100Hz, isQuaternion;
+        TrackerID nextID;
+
+        // ------------------------------------------------------------------------
+
+        void timerCallback() override
+        {
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                e->driver->service();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Pairs up the inputs and outputs called "Head Tracker...", by name and,
+            where several share a name, by their order, then adds and removes
+            drivers to match. */
+        void midiDevicesChanged() override
+        {
+            const juce::Array<juce::MidiDeviceInfo> outputs = devices->findAllOutputs(DeviceName);
+            const juce::Array<juce::MidiDeviceInfo> inputs = devices->findAllInputs(DeviceName);
+
+            std::vector<std::pair<juce::String, juce::String>> pairs; // output, input identifiers
+            std::vector<bool> inputUsed(static_cast<size_t>(inputs.size()), false);
+            for (const juce::MidiDeviceInfo& out: outputs)
+            {
+                for (int i = 0; i < inputs.size(); ++i)
+                {
+                    if (!inputUsed[static_cast<size_t>(i)] && (inputs[i].name == out.name))
+                    {
+                        inputUsed[static_cast<size_t>(i)] = true;
+                        pairs.emplace_back(out.identifier, inputs[i].identifier);
+                        break;
+                    }
+                }
+            }
+
+            // remove trackers that have gone
+            for (size_t i = 0; i < trackers.size();)
+            {
+                const bool stillThere = std::any_of(pairs.begin(), pairs.end(),
+                    [&](const std::pair<juce::String, juce::String>& p) { return keyFor(p) == trackers[i]->deviceKey; });
+                if (stillThere)
+                {
+                    ++i;
+                }
+                else
+                {
+                    const TrackerID id = trackers[i]->id;
+                    trackers.erase(trackers.begin() + static_cast<std::ptrdiff_t>(i));
+                    listeners.callMessageThread([id](Listener* l) { l->trackerRemoved(id); });
+                }
+            }
+
+            // and add new ones
+            for (const std::pair<juce::String, juce::String>& p: pairs)
+            {
+                const juce::String key = keyFor(p);
+                if (findByKey(key) == nullptr)
+                {
+                    add(key, p.first, p.second);
+                }
+            }
+
+            // the drivers don't listen to the device lists themselves
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                e->driver->service();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void add(const juce::String& key, const juce::String& outputIdentifier, const juce::String& inputIdentifier)
+        {
+            auto known = idsByDevice.find(key);
+            const TrackerID id = (known != idsByDevice.end()) ? known->second : nextID++;
+            idsByDevice[key] = id;
+
+            trackers.push_back(std::make_unique<Entry>(*this, id, key));
+            Entry& e = *trackers.back();
+            e.driver->pinToDevice(outputIdentifier, inputIdentifier);
+            e.driver->setExternallyServiced(true);
+            e.driver->addListener(&e.realtime, Dispatch::Realtime);
+            updateMessageThreadForwarding(e);
+            listeners.callMessageThread([id](Listener* l) { l->trackerAdded(id); });
+
+            if (connectAutomatically)
+            {
+                e.driver->setAutoReconnect(true);
+                e.driver->turnOn(is100Hz, isQuaternion);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Message-thread forwarding costs each driver a message per frame, so it
+            is only set up while someone is listening on the message thread. */
+        void updateMessageThreadForwarding()
+        {
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                updateMessageThreadForwarding(*e);
+            }
+        }
+
+        void updateMessageThreadForwarding(Entry& e)
+        {
+            const bool wanted = listeners.has(Dispatch::MessageThread);
+            if (wanted != e.forwardingToMessageThread)
+            {
+                e.forwardingToMessageThread = wanted;
+                if (wanted)
+                {
+                    e.driver->addListener(&e.messageThread, Dispatch::MessageThread);
+                }
+                else
+                {
+                    e.driver->removeListener(&e.messageThread);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        static juce::String keyFor(const std::pair<juce::String, juce::String>& identifiers)
+        {
+            return identifiers.first + "\n" + identifiers.second;
+        }
+
+        Entry* findByKey(const juce::String& key) const
+        {
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                if (e->deviceKey == key) return e.get();
+            }
+            return nullptr;
+        }
+
+        Entry* find(const TrackerID id) const
+        {
+            for (const std::unique_ptr<Entry>& e: trackers)
+            {
+                if (e->id == id) return e.get();
+            }
+            return nullptr;
+        }
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TrackerManager)
+    };
+};
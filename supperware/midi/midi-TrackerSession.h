@@ -0,0 +1,468 @@
+/*
+ * MIDI drivers
+ * C++20 coroutine interface for sequencing a head tracker session
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L)
+#define MIDI_TRACKERSESSION_AVAILABLE 1
+
+#include <coroutine>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace Midi
+{
+    /** Somewhere to resume suspended coroutines. post() and postAfter() may be
+        called from any thread, including the MIDI thread. */
+    class Executor
+    {
+    public:
+        virtual ~Executor() {}
+        virtual void post(std::function<void()> function) = 0;
+        virtual void postAfter(int milliseconds, std::function<void()> function) = 0;
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Resumes coroutines on the JUCE message thread. */
+    class MessageThreadExecutor : public Executor
+    {
+    public:
+        void post(std::function<void()> function) override
+        {
+            juce::MessageManager::callAsync(std::move(function));
+        }
+
+        void postAfter(int milliseconds, std::function<void()> function) override
+        {
+            juce::MessageManager::callAsync([milliseconds, function = std::move(function)]
+            {
+                juce::Timer::callAfterDelay(milliseconds, function);
+            });
+        }
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Resumes coroutines on whichever thread calls run(), for programs without
+        a JUCE message loop. */
+    class EventLoop : public Executor
+    {
+    public:
+        EventLoop() : quitting(false) {}
+
+        void post(std::function<void()> function) override
+        {
+            postAt(now(), std::move(function));
+        }
+
+        void postAfter(int milliseconds, std::function<void()> function) override
+        {
+            postAt(now() + std::chrono::milliseconds(milliseconds), std::move(function));
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Runs everything that is posted until quit() is called. */
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!quitting)
+            {
+                if (queue.empty())
+                {
+                    wake.wait(lock);
+                }
+                else if (queue.begin()->first > now())
+                {
+                    wake.wait_until(lock, queue.begin()->first);
+                }
+                else
+                {
+                    std::function<void()> function = std::move(queue.begin()->second);
+                    queue.erase(queue.begin());
+                    lock.unlock();
+                    function();
+                    lock.lock();
+                }
+            }
+            quitting = false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void quit()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quitting = true;
+            }
+            wake.notify_one();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::multimap<Clock::time_point, std::function<void()>> queue;
+        bool quitting;
+
+        static Clock::time_point now() { return Clock::now(); }
+
+        void postAt(const Clock::time_point when, std::function<void()> function)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.emplace(when, std::move(function));
+            }
+            wake.notify_one();
+        }
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Return type for a fire-and-forget session coroutine. It runs straight
+        away on the calling thread, and after each co_await on the executor. */
+    class Task
+    {
+    public:
+        struct promise_type
+        {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Awaitable events from a TrackerDriver. For example:
+
+            Midi::Task start(Midi::TrackerDriver& driver, Midi::TrackerSession& session)
+            {
+                driver.connectAsync();
+                if (!co_await session.connected(2000)) co_return;
+                auto readback = session.readback(500);
+                driver.turnOn();
+                std::optional<Tracker::State> state = co_await readback;
+                if (state && state->compassOn)
+                {
+                    driver.calibrateCompass();
+                    co_await session.compassCalibrated(30000);
+                }
+                Midi::TrackerSession::Frame f = co_await session.nextFrame();
+            }
+
+        An awaitable counts events from the moment it is created, so create it
+        before sending whatever provokes the event (as with readback above).
+        Only one coroutine may wait for each kind of event at once. Don't destroy
+        the session while a coroutine is waiting on it.
+
+        Use the state that readback() gives rather than TrackerDriver::getState(),
+        which may only be called on the message thread, so only from coroutines
+        resumed by a MessageThreadExecutor. */
+    class TrackerSession : private TrackerDriver::Listener
+    {
+    public:
+        struct Frame
+        {
+            Tracker::AngleMode angleMode;
+            float values[9]; // yaw/pitch/roll, w/x/y/z, or a row-major matrix
+        };
+
+        // ------------------------------------------------------------------------
+
+        TrackerSession(TrackerDriver& trackerDriver, Executor& executor) :
+            driver(trackerDriver),
+            shared(std::make_shared<Shared>(executor))
+        {
+            driver.addListener(this, Dispatch::Realtime);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~TrackerSession()
+        {
+            driver.removeListener(this);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        enum Event { ConnectedEvent, ReadbackEvent, FrameEvent, CompassEvent, NumEvents };
+
+        struct Waiter
+        {
+            std::coroutine_handle<> handle;
+            bool result;
+            Frame frame;
+            Tracker::State state;
+        };
+
+        struct Shared
+        {
+            Shared(Executor& e) : executor(e), nextTicket(1) {}
+
+            Executor& executor;
+            juce::SpinLock lock;
+            Waiter* waiting[NumEvents] = {};
+            uint64_t waitingTicket[NumEvents] = {};
+            uint32_t generation[NumEvents] = {};
+            bool lastResult[NumEvents] = {};
+            Frame lastFrame = {};
+            Tracker::State lastState;
+            uint64_t nextTicket;
+
+            /** Called by the driver's listener callbacks. */
+            void fire(const Event event, const bool result, const Frame* frame, const Tracker::State* state = nullptr)
+            {
+                Waiter* w;
+                {
+                    const juce::SpinLock::ScopedLockType sl(lock);
+                    ++generation[event];
+                    lastResult[event] = result;
+                    if (frame) lastFrame = *frame;
+                    if (state) lastState = *state;
+                    w = waiting[event];
+                    waiting[event] = nullptr;
+                }
+                if (w)
+                {
+                    w->result = result;
+                    if (frame) w->frame = *frame;
+                    if (state) w->state = *state;
+                    executor.post([h = w->handle] { h.resume(); });
+                }
+            }
+        };
+
+    public:
+        /** Awaits an event; co_await gives true if it happened, or false if it
+            timed out (or, for compassCalibrated, if calibration failed). */
+        class Awaiter
+        {
+        public:
+            Awaiter(std::shared_ptr<Shared> s, const Event e, const int timeout, const bool isReadyNow) :
+                shared(std::move(s)), event(e), timeoutMilliseconds(timeout), readyNow(isReadyNow), ticket(0)
+            {
+                const juce::SpinLock::ScopedLockType sl(shared->lock);
+                generation = shared->generation[event];
+            }
+
+            bool await_ready()
+            {
+                if (readyNow)
+                {
+                    waiter.result = true;
+                    return true;
+                }
+                const juce::SpinLock::ScopedLockType sl(shared->lock);
+                return collectIfFired();
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                waiter.handle = handle;
+                {
+                    const juce::SpinLock::ScopedLockType sl(shared->lock);
+                    if (collectIfFired())
+                    {
+                        return false; // fired since await_ready: carry on
+                    }
+                    jassert(shared->waiting[event] == nullptr); // one waiter per event
+                    ticket = shared->nextTicket++;
+                    shared->waiting[event] = &waiter;
+                    shared->waitingTicket[event] = ticket;
+                }
+                if (timeoutMilliseconds >= 0)
+                {
+                    std::weak_ptr<Shared> weak = shared;
+                    shared->executor.postAfter(timeoutMilliseconds, [weak, e = event, t = ticket]
+                    {
+                        if (std::shared_ptr<Shared> s = weak.lock())
+                        {
+                            Waiter* w = nullptr;
+                            {
+                                const juce::SpinLock::ScopedLockType sl(s->lock);
+                                if (s->waiting[e] && (s->waitingTicket[e] == t))
+                                {
+                                    w = s->waiting[e];
+                                    s->waiting[e] = nullptr;
+                                }
+                            }
+                            if (w)
+                            {
+                                w->result = false;
+                                w->handle.resume(); // already on the executor
+                            }
+                        }
+                    });
+                }
+                return true;
+            }
+
+            bool await_resume() const
+            {
+                return waiter.result;
+            }
+
+        protected:
+            std::shared_ptr<Shared> shared;
+            Event event;
+            int timeoutMilliseconds;
+            bool readyNow;
+            uint32_t generation;
+            uint64_t ticket;
+            Waiter waiter;
+
+            bool collectIfFired()
+            {
+                if (shared->generation[event] == generation)
+                {
+                    return false;
+                }
+                waiter.result = shared->lastResult[event];
+                waiter.frame = shared->lastFrame;
+                waiter.state = shared->lastState;
+                return true;
+            }
+        };
+
+        // ------------------------------------------------------------------------
+
+        /** Awaits the next orientation frame, in whatever format the tracker was
+            turned on with. */
+        class FrameAwaiter : public Awaiter
+        {
+        public:
+            using Awaiter::Awaiter;
+
+            Frame await_resume() const
+            {
+                return waiter.frame;
+            }
+        };
+
+        // ------------------------------------------------------------------------
+
+        /** Awaits a readback, giving the tracker's state as it was when the reply
+            had been processed, or nothing if it timed out. */
+        class ReadbackAwaiter : public Awaiter
+        {
+        public:
+            using Awaiter::Awaiter;
+
+            std::optional<Tracker::State> await_resume() const
+            {
+                if (!waiter.result) return std::nullopt;
+                return waiter.state;
+            }
+        };
+
+        // ------------------------------------------------------------------------
+
+        /** Moves the coroutine onto the executor. */
+        class ScheduleAwaiter
+        {
+        public:
+            ScheduleAwaiter(Executor& e) : executor(e) {}
+            bool await_ready() const { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { executor.post([handle] { handle.resume(); }); }
+            void await_resume() const {}
+
+        private:
+            Executor& executor;
+        };
+
+        // ------------------------------------------------------------------------
+
+        /** Completes as soon as the driver is connected (immediately, if it already is). */
+        Awaiter connected(const int timeoutMilliseconds = -1)
+        {
+            return Awaiter(shared, ConnectedEvent, timeoutMilliseconds, driver.getConnectionState() == State::Connected);
+        }
+
+        /** Completes when the next full readback (the default parameter set) has
+            been processed, giving a copy of the state it left behind. */
+        ReadbackAwaiter readback(const int timeoutMilliseconds = -1)
+        {
+            return ReadbackAwaiter(shared, ReadbackEvent, timeoutMilliseconds, false);
+        }
+
+        /** Completes when compass calibration ends, with true if it succeeded. */
+        Awaiter compassCalibrated(const int timeoutMilliseconds = -1)
+        {
+            return Awaiter(shared, CompassEvent, timeoutMilliseconds, false);
+        }
+
+        FrameAwaiter nextFrame()
+        {
+            return FrameAwaiter(shared, FrameEvent, -1, false);
+        }
+
+        ScheduleAwaiter schedule()
+        {
+            return ScheduleAwaiter(shared->executor);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        TrackerDriver& driver;
+        std::shared_ptr<Shared> shared;
+
+        // ------------------------------------------------------------------------
+
+        void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+        {
+            const Frame f { Tracker::AngleMode::YPR, { yawRadian, pitchRadian, rollRadian } };
+            shared->fire(FrameEvent, true, &f);
+        }
+
+        void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+        {
+            const Frame f { Tracker::AngleMode::Quaternion, { qw, qx, qy, qz } };
+            shared->fire(FrameEvent, true, &f);
+        }
+
+        void trackerOrientationM(float* matrix) override
+        {
+            Frame f { Tracker::AngleMode::Matrix, {} };
+            std::copy(matrix, matrix + 9, f.values);
+            shared->fire(FrameEvent, true, &f);
+        }
+
+        void trackerConnectionChanged(const Tracker::State& state) override
+        {
+            shared->fire(ReadbackEvent, true, nullptr, &state);
+        }
+
+        void trackerCompassStateChanged(Tracker::CompassState compassState) override
+        {
+            if ((compassState == Tracker::CompassState::Succeeded) || (compassState == Tracker::CompassState::Failed))
+            {
+                shared->fire(CompassEvent, compassState == Tracker::CompassState::Succeeded, nullptr);
+            }
+        }
+
+        void trackerMidiConnectionChanged(Midi::State state) override
+        {
+            if (state == State::Connected)
+            {
+                shared->fire(ConnectedEvent, true, nullptr);
+            }
+        }
+    };
+};
+
+#endif
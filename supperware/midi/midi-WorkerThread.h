@@ -0,0 +1,111 @@
+/*
+ * MIDI drivers
+ * One thread running short jobs for any number of drivers
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** A thread that sleeps until one of its jobs is woken, then runs every job
+        that has been woken since it last looked. Each MIDI driver normally has
+        a thread of its own for opening ports and another for sending commands;
+        TrackerManager instead shares one of each between all of its drivers,
+        so that the number of threads doesn't grow with the number of trackers.
+
+        wake() may be called from any thread, including the audio thread: it
+        sets the job's flag, and only if that wasn't already set, signals the
+        thread's event, which takes that event's mutex for an instant. So a
+        burst of posts costs one signal until the job runs. Jobs are added and
+        removed on any other thread. */
+    class WorkerThread : private juce::Thread
+    {
+    public:
+        class Job
+        {
+        public:
+            Job() : due(false) {}
+            virtual ~Job() {}
+
+            /** On the worker thread, once after any number of wake() calls. */
+            virtual void runJob() = 0;
+
+        private:
+            friend class WorkerThread;
+            std::atomic<bool> due;
+        };
+
+        // ------------------------------------------------------------------------
+
+        WorkerThread(const juce::String& threadName) :
+            juce::Thread(threadName)
+        {
+            startThread();
+        }
+
+        ~WorkerThread()
+        {
+            // every job should have removed itself by now
+            jassert(jobs.isEmpty());
+            signalThreadShouldExit();
+            notify();
+            stopThread(StopMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void add(Job* job)
+        {
+            const juce::ScopedLock sl(jobLock);
+            jobs.addIfNotAlreadyThere(job);
+        }
+
+        /** Once this returns, the job isn't running and won't be run again. Waits
+            for it if it is running now. */
+        void remove(Job* job)
+        {
+            const juce::ScopedLock sl(jobLock);
+            jobs.removeFirstMatchingValue(job);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Asks for job to be run soon. */
+        void wake(Job& job)
+        {
+            // already due: the job hasn't run yet, so it will see this post too
+            if (!job.due.exchange(true, std::memory_order_acq_rel))
+            {
+                notify();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int StopMilliseconds = 2000;
+
+        juce::CriticalSection jobLock;
+        juce::Array<Job*> jobs;
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                wait(-1);
+                const juce::ScopedLock sl(jobLock);
+                for (Job* job: jobs)
+                {
+                    // a wake() after this still finds the event signalled
+                    if (job->due.exchange(false, std::memory_order_acquire))
+                    {
+                        job->runJob();
+                    }
+                }
+            }
+        }
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WorkerThread)
+    };
+};
@@ -6,5 +6,16 @@
 #pragma once
 #define MIDI_H_INCLUDED
 
+#include "midi-Mailbox.h"
+#include "midi-ListenerList.h"
+#include "midi-DeviceCache.h"
+#include "midi-ArrivalStatistics.h"
+#include "midi-RawQueue.h"
+#include "midi-WorkerThread.h"
 #include "midi-MidiDuplex.h"
+#include "midi-CommandQueue.h"
+#include "midi-Requests.h"
 #include "midi-TrackerDriver.h"
+#include "midi-TrackerManager.h"
+#include "midi-FailoverController.h"
+#include "midi-TrackerSession.h"
@@ -0,0 +1,371 @@
+/*
+ * OSC
+ * Encodes OSC messages and bundles into a caller's buffer, and finds the
+ * messages in a received packet without copying them
+ * This class doesn't need JUCE!
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Osc
+{
+    static constexpr size_t MaxArguments = 16;
+
+    /** Writes OSC 1.0 packets of float messages into a fixed buffer, without
+        allocating. Either write one message, or begin a bundle and add several
+        messages to it. If the buffer fills up, the add fails and the packet so
+        far is left intact. */
+    class Encoder
+    {
+    public:
+        static constexpr uint64_t Immediately = 1; // the OSC time tag meaning 'now'
+
+        Encoder(uint8_t* buffer, const size_t capacity) :
+            data(buffer),
+            size(capacity),
+            used(0),
+            inBundle(false)
+        {}
+
+        // --------------------------------------------------------------------
+
+        void reset()
+        {
+            used = 0;
+            inBundle = false;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Starts a bundle: every message added until reset() goes inside it. */
+        bool beginBundle(const uint64_t timeTag = Immediately)
+        {
+            reset();
+            if (!writeString("#bundle") || !writeUint32(static_cast<uint32_t>(timeTag >> 32)) ||
+                !writeUint32(static_cast<uint32_t>(timeTag)))
+            {
+                reset();
+                return false;
+            }
+            inBundle = true;
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Adds a message with numValues float arguments. Outside a bundle, this
+            replaces whatever was there before. */
+        bool addMessage(const char* address, const float* values, const size_t numValues)
+        {
+            if (!inBundle)
+            {
+                used = 0;
+            }
+            const size_t start = used;
+
+            // a bundle element is preceded by its size, filled in afterwards
+            if (inBundle && !writeUint32(0))
+            {
+                return fail(start);
+            }
+            const size_t bodyStart = used;
+
+            char typeTags[MaxArguments + 2] = { ',' };
+            if (numValues > MaxArguments)
+            {
+                return fail(start);
+            }
+            for (size_t i = 0; i < numValues; ++i)
+            {
+                typeTags[i + 1] = 'f';
+            }
+            typeTags[numValues + 1] = 0;
+
+            if (!writeString(address) || !writeString(typeTags))
+            {
+                return fail(start);
+            }
+            for (size_t i = 0; i < numValues; ++i)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, &values[i], sizeof(bits));
+                if (!writeUint32(bits))
+                {
+                    return fail(start);
+                }
+            }
+
+            if (inBundle)
+            {
+                putUint32(start, static_cast<uint32_t>(used - bodyStart));
+            }
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        const uint8_t* getData() const { return data; }
+        size_t getSize() const { return used; }
+        bool isEmpty() const { return used == 0; }
+
+        // --------------------------------------------------------------------
+
+    private:
+        uint8_t* data;
+        size_t size;
+        size_t used;
+        bool inBundle;
+
+        // --------------------------------------------------------------------
+
+        bool fail(const size_t rewindTo)
+        {
+            used = rewindTo;
+            return false;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Writes a null-terminated string, padded to a multiple of four bytes. */
+        bool writeString(const char* s)
+        {
+            const size_t length = std::strlen(s);
+            const size_t padded = (length + 4) & ~static_cast<size_t>(3);
+            if (used + padded > size)
+            {
+                return false;
+            }
+            std::memcpy(data + used, s, length);
+            std::memset(data + used + length, 0, padded - length);
+            used += padded;
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        bool writeUint32(const uint32_t value)
+        {
+            if (used + 4 > size)
+            {
+                return false;
+            }
+            putUint32(used, value);
+            used += 4;
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** OSC is big-endian. */
+        void putUint32(const size_t position, const uint32_t value)
+        {
+            data[position]     = static_cast<uint8_t>(value >> 24);
+            data[position + 1] = static_cast<uint8_t>(value >> 16);
+            data[position + 2] = static_cast<uint8_t>(value >> 8);
+            data[position + 3] = static_cast<uint8_t>(value);
+        }
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** One message in a received packet. It points into the packet, so is only
+        valid until the packet's buffer is reused. */
+    class Message
+    {
+    public:
+        const char* getAddress() const { return address; }
+        bool hasAddress(const char* a) const { return std::strcmp(address, a) == 0; }
+        size_t getNumArguments() const { return numArguments; }
+
+        /** True if argument i is a number: a float, double, or 32-bit integer. */
+        bool isNumber(const size_t i) const
+        {
+            return (i < numArguments) && ((tags[i] == 'f') || (tags[i] == 'd') || (tags[i] == 'i'));
+        }
+
+        /** True if the first count arguments are all numbers. */
+        bool hasNumbers(const size_t count) const
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!isNumber(i)) return false;
+            }
+            return true;
+        }
+
+        /** Argument i as a float, or zero if it's not a number. */
+        float getFloat(const size_t i) const
+        {
+            if (!isNumber(i))
+            {
+                return 0.0f;
+            }
+            const uint8_t* p = arguments[i];
+            if (tags[i] == 'd')
+            {
+                const uint64_t bits = (static_cast<uint64_t>(getUint32(p)) << 32) | getUint32(p + 4);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return static_cast<float>(value);
+            }
+            const uint32_t bits = getUint32(p);
+            if (tags[i] == 'i')
+            {
+                return static_cast<float>(static_cast<int32_t>(bits));
+            }
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+    private:
+        friend class Decoder;
+
+        const char* address;
+        const char* tags; // after the comma
+        const uint8_t* arguments[MaxArguments];
+        size_t numArguments;
+
+        static uint32_t getUint32(const uint8_t* p)
+        {
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+        }
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Walks through an OSC packet (a message, or a bundle of them, nested to
+        any sensible depth), calling back with each message in turn. Nothing is
+        copied or allocated. Malformed data is checked against the packet size,
+        and stops the walk. */
+    class Decoder
+    {
+    public:
+        /** messageFound is called as messageFound(const Message&). Returns false
+            if the packet was malformed (though messages before the fault will
+            already have been passed on). Time tags are ignored: everything is
+            treated as arriving now. */
+        template <typename Callback>
+        static bool decode(const uint8_t* data, const size_t size, Callback&& messageFound)
+        {
+            return decodeElement(data, size, messageFound, 0);
+        }
+
+    private:
+        static constexpr int MaxDepth = 4;
+
+        template <typename Callback>
+        static bool decodeElement(const uint8_t* data, const size_t size, Callback& messageFound, const int depth)
+        {
+            if ((size < 4) || (size & 3))
+            {
+                return false;
+            }
+            if (data[0] == '#')
+            {
+                return decodeBundle(data, size, messageFound, depth);
+            }
+            Message message;
+            if (!parseMessage(data, size, message))
+            {
+                return false;
+            }
+            messageFound(static_cast<const Message&>(message));
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        template <typename Callback>
+        static bool decodeBundle(const uint8_t* data, const size_t size, Callback& messageFound, const int depth)
+        {
+            size_t position = 0;
+            const char* header;
+            if ((depth >= MaxDepth) || !readString(data, size, position, header) ||
+                (std::strcmp(header, "#bundle") != 0) || (position + 8 > size))
+            {
+                return false;
+            }
+            position += 8; // time tag
+            while (position < size)
+            {
+                if (position + 4 > size)
+                {
+                    return false;
+                }
+                const size_t elementSize = Message::getUint32(data + position);
+                position += 4;
+                if ((elementSize > size - position) ||
+                    !decodeElement(data + position, elementSize, messageFound, depth + 1))
+                {
+                    return false;
+                }
+                position += elementSize;
+            }
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        static bool parseMessage(const uint8_t* data, const size_t size, Message& message)
+        {
+            size_t position = 0;
+            const char* tags;
+            if (!readString(data, size, position, message.address) || (message.address[0] != '/'))
+            {
+                return false;
+            }
+            message.numArguments = 0;
+            message.tags = "";
+            if (position == size)
+            {
+                return true; // old-style message without type tags
+            }
+            if (!readString(data, size, position, tags) || (tags[0] != ',') || (std::strlen(tags) - 1 > MaxArguments))
+            {
+                return false;
+            }
+            message.tags = tags + 1;
+            for (const char* t = message.tags; *t; ++t)
+            {
+                size_t argumentSize = 0;
+                switch (*t)
+                {
+                    case 'f': case 'i': argumentSize = 4; break;
+                    case 'd': argumentSize = 8; break;
+                    case 'T': case 'F': case 'N': case 'I': break;
+                    default: return false; // strings, blobs and so on: not for us
+                }
+                if (position + argumentSize > size)
+                {
+                    return false;
+                }
+                message.arguments[message.numArguments++] = data + position;
+                position += argumentSize;
+            }
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+
+        /** Points to a padded, null-terminated string and moves past it. */
+        static bool readString(const uint8_t* data, const size_t size, size_t& position, const char*& s)
+        {
+            const void* end = std::memchr(data + position, 0, size - position);
+            if (!end)
+            {
+                return false;
+            }
+            const size_t length = static_cast<size_t>(static_cast<const uint8_t*>(end) - (data + position));
+            s = reinterpret_cast<const char*>(data + position);
+            position += (length + 4) & ~static_cast<size_t>(3);
+            return position <= size;
+        }
+    };
+};
@@ -0,0 +1,183 @@
+/*
+ * OSC
+ * Receives head tracker orientation from OSC over UDP
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Osc
+{
+    /** Listens on a UDP port for orientation in Bridgehead's OSC convention,
+        /quaternion w x y z or /ypr yaw pitch roll (in degrees), alone or in
+        bundles, and passes each frame to a Tracker::Listener just as Tracker
+        does with MIDI. So a machine without a head tracker can run from one
+        elsewhere on the network.
+
+        A TrackerDriver is a Tracker::Listener: give it to this receiver, and
+        everything listening to the driver (a HeadPanel, an OscSender, the
+        orientation bus and so on) gets the network frames too. Don't connect
+        that driver to a head tracker as well, or the two streams will be
+        interleaved. Or give the receiver any other Tracker::Listener.
+
+        Packets are parsed where they land in a preallocated buffer, and the
+        listener is called on the receiving thread: like the MIDI thread, it
+        must not be held up. */
+    class OscReceiver : private juce::Thread
+    {
+    public:
+        OscReceiver(Tracker::Listener* trackerListener) :
+            juce::Thread("OSC receiver"),
+            listener(trackerListener),
+            buffer(BufferSize),
+            packetsReceived(0),
+            packetsRejected(0)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        ~OscReceiver()
+        {
+            stop();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Binds to a local port (and, optionally, one local address only) and
+            starts receiving. Returns false if the port can't be bound. */
+        bool start(const int port, const juce::String& localAddress = {})
+        {
+            stop();
+            socket.reset(new juce::DatagramSocket(false));
+            const bool bound = localAddress.isEmpty() ? socket->bindToPort(port) : socket->bindToPort(port, localAddress);
+            if (!bound)
+            {
+                socket.reset();
+                return false;
+            }
+            arrivals.reset();
+            startThread();
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void stop()
+        {
+            if (socket)
+            {
+                signalThreadShouldExit();
+                socket->shutdown();
+                stopThread(1000);
+                socket.reset();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The port actually bound, or -1 if not receiving. */
+        int getPort() const
+        {
+            return socket ? socket->getBoundPort() : -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** When the last packet with orientation in it arrived, in
+            juce::Time::getMillisecondCounterHiRes() milliseconds, or zero. */
+        double getLastPacketTime() const { return arrivals.getLastArrival(); }
+
+        /** The average time between those packets, once enough have arrived. */
+        double getPacketInterval() const { return arrivals.getInterval(); }
+
+        /** True if orientation has arrived within the last few packet periods. */
+        bool isReceiving() const
+        {
+            const double last = arrivals.getLastArrival();
+            const double interval = arrivals.getInterval();
+            const double timeout = (interval > 0.0) ? LostPackets * interval : static_cast<double>(TimeoutMilliseconds);
+            return (last > 0.0) && ((juce::Time::getMillisecondCounterHiRes() - last) < timeout);
+        }
+
+        uint64_t getPacketsReceived() const { return packetsReceived.load(); }
+
+        /** Packets that weren't valid OSC. Packets of other OSC messages are
+            received, and ignored, without counting here. */
+        uint64_t getPacketsRejected() const { return packetsRejected.load(); }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int BufferSize = 65536;           // the largest UDP datagram
+        static constexpr int TimeoutMilliseconds = 600;    // before the rate is known
+        static constexpr double LostPackets = 8.0;
+        static constexpr float RadiansPerDegree = juce::MathConstants<float>::pi / 180.0f;
+
+        Tracker::Listener* listener;
+        std::unique_ptr<juce::DatagramSocket> socket;
+        juce::HeapBlock<uint8_t> buffer;
+        Midi::ArrivalStatistics arrivals;
+        std::atomic<uint64_t> packetsReceived;
+        std::atomic<uint64_t> packetsRejected;
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                if (socket->waitUntilReady(true, 100) <= 0)
+                {
+                    continue;
+                }
+                const int size = socket->read(buffer.get(), BufferSize, false);
+                if (size <= 0)
+                {
+                    continue;
+                }
+                // timestamp before parsing, so that the time is the arrival time
+                const double now = juce::Time::getMillisecondCounterHiRes();
+                packetsReceived.fetch_add(1, std::memory_order_relaxed);
+
+                bool hadOrientation = false;
+                const bool ok = Decoder::decode(buffer.get(), static_cast<size_t>(size), [&](const Message& m)
+                {
+                    hadOrientation = handleMessage(m) || hadOrientation;
+                });
+                if (!ok)
+                {
+                    packetsRejected.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (hadOrientation)
+                {
+                    arrivals.noteArrival(now);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Returns true if the message was orientation. */
+        bool handleMessage(const Message& m)
+        {
+            if (m.hasAddress("/quaternion") && m.hasNumbers(4))
+            {
+                if (listener)
+                {
+                    listener->trackerOrientationQ(m.getFloat(0), m.getFloat(1), m.getFloat(2), m.getFloat(3));
+                }
+                return true;
+            }
+            if (m.hasAddress("/ypr") && m.hasNumbers(3))
+            {
+                if (listener)
+                {
+                    listener->trackerOrientation(m.getFloat(0) * RadiansPerDegree, m.getFloat(1) * RadiansPerDegree,
+                                                 m.getFloat(2) * RadiansPerDegree);
+                }
+                return true;
+            }
+            return false;
+        }
+    };
+};
@@ -0,0 +1,392 @@
+/*
+ * OSC
+ * Sends head tracker orientation to OSC receivers over UDP
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_WINDOWS
+ #include <winsock2.h>
+ #include <ws2tcpip.h>
+#else
+ #include <netdb.h>
+ #include <netinet/in.h>
+ #include <sys/socket.h>
+#endif
+
+namespace Osc
+{
+    /** Listens to a TrackerDriver and sends every frame of orientation as OSC
+        to any number of UDP targets: local apps or other machines on the LAN.
+        Several frames may be bundled into one packet to reduce network load.
+
+        Encoding and sending use preallocated buffers only, and targets are
+        resolved when they are added, so sending never looks up a name. By
+        default, frames are handed from the MIDI thread to a sending thread
+        through a lock-free FIFO, so that the network never holds up the
+        tracker; alternatively, packets may be sent directly from the MIDI
+        thread. A bundle that is still filling when frames stop is sent after
+        FlushMilliseconds by the sending thread or, when sending directly,
+        when the tracker disconnects.
+
+        The driver must outlive the sender. */
+    class OscSender : private Midi::TrackerDriver::Listener, private juce::Thread
+    {
+    public:
+        /** Which messages to send for each frame; combine with |. */
+        enum Content
+        {
+            Quaternion     = 1, // /quaternion w x y z
+            YawPitchRoll   = 2, // /ypr yaw pitch roll, in degrees
+            SeparateAngles = 4  // /yaw, /pitch and /roll, in degrees
+        };
+
+        static constexpr int MaxFramesPerBundle = 8;
+        static constexpr int FlushMilliseconds = 50;
+
+        // ------------------------------------------------------------------------
+
+        OscSender(Midi::TrackerDriver& trackerDriver, const bool useOwnThread = true) :
+            juce::Thread("OSC sender"),
+            driver(trackerDriver),
+            ownThread(useOwnThread),
+            content(Quaternion),
+            framesPerBundle(1),
+            framesInBundle(0),
+            fifo(FifoSize),
+            encoder(packet, sizeof(packet)),
+            socket(false),
+            packetsSent(0),
+            framesDropped(0)
+        {
+            if (ownThread)
+            {
+                startThread();
+            }
+            driver.addListener(this, Midi::Dispatch::Realtime);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~OscSender()
+        {
+            driver.removeListener(this);
+            if (ownThread)
+            {
+                signalThreadShouldExit();
+                notify();
+                stopThread(1000);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Adds a destination, such as ("127.0.0.1", 9000). The name is looked
+            up here, on the calling thread, which it may block; returns false if
+            it can't be resolved to an IPv4 address. */
+        bool addTarget(const juce::String& host, const int port)
+        {
+            std::unique_ptr<Target> target(new Target(host, port));
+            addrinfo hints {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* result = nullptr;
+            if ((getaddrinfo(host.toRawUTF8(), std::to_string(port).c_str(), &hints, &result) != 0) || !result)
+            {
+                return false;
+            }
+            std::memcpy(&target->address, result->ai_addr, sizeof(target->address));
+            freeaddrinfo(result);
+
+            const juce::ScopedLock sl(targetLock);
+            targets.add(target.release());
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void removeTarget(const juce::String& host, const int port)
+        {
+            const juce::ScopedLock sl(targetLock);
+            for (int i = targets.size(); --i >= 0;)
+            {
+                if ((targets[i]->host == host) && (targets[i]->port == port))
+                {
+                    targets.remove(i);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void removeAllTargets()
+        {
+            const juce::ScopedLock sl(targetLock);
+            targets.clear();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** A combination of the Content flags. */
+        void setContent(const int contentFlags)
+        {
+            content.store(contentFlags);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** With more than one frame per packet, frames are wrapped in an OSC
+            bundle and sent when it is full. One frame per packet (the default)
+            sends each message as a plain datagram, which every OSC receiver
+            understands. */
+        void setFramesPerBundle(const int frames)
+        {
+            framesPerBundle.store(juce::jlimit(1, MaxFramesPerBundle, frames));
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getPacketsSent() const { return packetsSent.load(); }
+
+        /** Frames lost because the sending thread fell behind, or (when sending
+            from the MIDI thread) because the targets were being changed. */
+        uint64_t getFramesDropped() const { return framesDropped.load(); }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int FifoSize = 64;
+        static constexpr float DegreesPerRadian = 180.0f / juce::MathConstants<float>::pi;
+
+        struct Frame
+        {
+            float quaternion[4];
+            float ypr[3]; // degrees
+        };
+
+        struct Target
+        {
+            Target(const juce::String& targetHost, const int targetPort) :
+                host(targetHost), port(targetPort), address {}
+            {}
+
+            juce::String host;
+            int port;
+            sockaddr_in address;
+        };
+
+        Midi::TrackerDriver& driver;
+        const bool ownThread;
+        std::atomic<int> content;
+        std::atomic<int> framesPerBundle;
+        int framesInBundle;                // these belong to whichever thread sends
+        HeadMatrix head;                   // MIDI thread only
+        Frame frames[FifoSize];
+        juce::AbstractFifo fifo;
+        uint8_t packet[1472];              // fits an Ethernet frame without fragmenting
+        Encoder encoder;
+        juce::DatagramSocket socket;       // unbound, send-only; also starts Winsock for addTarget()
+        juce::CriticalSection targetLock;
+        juce::OwnedArray<Target> targets;
+        std::atomic<uint64_t> packetsSent;
+        std::atomic<uint64_t> framesDropped;
+
+        // ------------------------------------------------------------------------
+        // Called on the MIDI thread
+
+        void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+        {
+            head.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+            frameArrived();
+        }
+        void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+        {
+            head.setOrientationQuaternion(qw, qx, qy, qz);
+            frameArrived();
+        }
+        void trackerOrientationM(float* matrix) override
+        {
+            head.setOrientationMatrix(matrix);
+            frameArrived();
+        }
+
+        /** On the message thread. The sending thread flushes on its own. */
+        void trackerMidiConnectionChanged(Midi::State state) override
+        {
+            if (!ownThread && (state != Midi::State::Connected))
+            {
+                const juce::ScopedLock sl(targetLock);
+                flushBundle();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void frameArrived()
+        {
+            Frame frame;
+            head.getQuaternion(frame.quaternion[0], frame.quaternion[1], frame.quaternion[2], frame.quaternion[3]);
+            head.getYPR(frame.ypr[0], frame.ypr[1], frame.ypr[2]);
+            for (float& angle: frame.ypr)
+            {
+                angle *= DegreesPerRadian;
+            }
+
+            if (!ownThread)
+            {
+                // never wait for the message thread to finish changing targets
+                const juce::ScopedTryLock stl(targetLock);
+                if (stl.isLocked())
+                {
+                    encodeFrame(frame);
+                }
+                else
+                {
+                    framesDropped.fetch_add(1);
+                }
+                return;
+            }
+
+            int start1, size1, start2, size2;
+            fifo.prepareToWrite(1, start1, size1, start2, size2);
+            if (size1 == 0)
+            {
+                framesDropped.fetch_add(1);
+                return;
+            }
+            frames[start1] = frame;
+            fifo.finishedWrite(1);
+            notify();
+        }
+
+        // ------------------------------------------------------------------------
+        // Called on the sending thread
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                // a bundle that is still filling goes out if no more frames come
+                const bool woken = wait((framesInBundle > 0) ? FlushMilliseconds : -1);
+                int start1, size1, start2, size2;
+                fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+                {
+                    const juce::ScopedLock sl(targetLock);
+                    for (int i = 0; i < size1; ++i) encodeFrame(frames[start1 + i]);
+                    for (int i = 0; i < size2; ++i) encodeFrame(frames[start2 + i]);
+                    if (!woken && (size1 + size2 == 0))
+                    {
+                        flushBundle();
+                    }
+                }
+                fifo.finishedRead(size1 + size2);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+        // Called with targetLock held
+
+        void encodeFrame(const Frame& frame)
+        {
+            const int flags = content.load(std::memory_order_relaxed);
+            const int bundleSize = framesPerBundle.load(std::memory_order_relaxed);
+
+            if (bundleSize == 1)
+            {
+                // one datagram per message, after anything left over from bundling
+                flushBundle();
+                if (flags & Quaternion)
+                {
+                    encoder.addMessage("/quaternion", frame.quaternion, 4);
+                    send();
+                }
+                if (flags & YawPitchRoll)
+                {
+                    encoder.addMessage("/ypr", frame.ypr, 3);
+                    send();
+                }
+                if (flags & SeparateAngles)
+                {
+                    encoder.addMessage("/yaw", &frame.ypr[0], 1);
+                    send();
+                    encoder.addMessage("/pitch", &frame.ypr[1], 1);
+                    send();
+                    encoder.addMessage("/roll", &frame.ypr[2], 1);
+                    send();
+                }
+                return;
+            }
+
+            if (framesInBundle == 0)
+            {
+                encoder.beginBundle();
+            }
+            if (!addToBundle(frame, flags))
+            {
+                // too big to fit (shouldn't happen at MaxFramesPerBundle): send
+                // what there is, and start again
+                send();
+                encoder.beginBundle();
+                framesInBundle = 0;
+                addToBundle(frame, flags);
+            }
+            if (++framesInBundle >= bundleSize)
+            {
+                send();
+                framesInBundle = 0;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool addToBundle(const Frame& frame, const int flags)
+        {
+            bool ok = true;
+            if (flags & Quaternion)
+            {
+                ok = ok && encoder.addMessage("/quaternion", frame.quaternion, 4);
+            }
+            if (flags & YawPitchRoll)
+            {
+                ok = ok && encoder.addMessage("/ypr", frame.ypr, 3);
+            }
+            if (flags & SeparateAngles)
+            {
+                ok = ok && encoder.addMessage("/yaw", &frame.ypr[0], 1)
+                        && encoder.addMessage("/pitch", &frame.ypr[1], 1)
+                        && encoder.addMessage("/roll", &frame.ypr[2], 1);
+            }
+            return ok;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void flushBundle()
+        {
+            if (framesInBundle > 0)
+            {
+                send();
+                framesInBundle = 0;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void send()
+        {
+            if (!encoder.isEmpty())
+            {
+                const int size = static_cast<int>(encoder.getSize());
+                const auto handle = socket.getRawSocketHandle();
+                for (Target* target: targets)
+                {
+                    sendto(handle, reinterpret_cast<const char*>(encoder.getData()), size, 0,
+                           reinterpret_cast<const sockaddr*>(&target->address), sizeof(target->address));
+                }
+                packetsSent.fetch_add(1);
+            }
+            encoder.reset();
+        }
+    };
+};
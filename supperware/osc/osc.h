@@ -0,0 +1,11 @@
+/*
+ * OSC
+ * Copyright (c) 2023 Supperware Ltd.
+ */
+
+#pragma once
+#define OSC_H_INCLUDED
+
+#include "osc-OscFormat.h"
+#include "osc-OscSender.h"
+#include "osc-OscReceiver.h"